@@ -6,6 +6,33 @@
  *   - Real-time line chart (0..0.5 scale) with visible tick labels
  *   - Second Window showing y-values of each line
  *   - Up/Down arrow keys to change disk speed
+ *   - Optional DSMC collision engine for dilute systems (--engine=dsmc)
+ *   - Optional lattice-gas companion run plotted in the same chart (--lattice=N)
+ *   - Optional coin exchange along the edges of a CSR graph (--graph=edges.txt)
+ *   - Automatic burn-in detection; averages over the equilibrated window only
+ *   - CSV export of the averaged histogram on exit (--export=file.csv)
+ *   - Warm start: initial coins sampled from a saved histogram (--init=file.csv)
+ *   - Live median / p90 / p99 coin holdings and Gini coefficient
+ *   - Per-disk time-at-coin-value counters and an ergodicity-gap metric
+ *   - Speed / kinetic-energy histograms with temperature fits (--velocity-chart)
+ *   - Grid broad phase for the geometric engine; radial distribution g(r)
+ *     accumulated from its neighbour search (--export-rdf=file.csv)
+ *   - Standard errors from integrated autocorrelation times (--target-error)
+ *   - Exact finite-N microcanonical reference curves overlaid on the chart
+ *   - Headless statistical-equivalence check of the engines (--check-engines)
+ *   - Per-step state digests and a digest-stream comparer (--digest, --compare-digests)
+ *   - Chrome trace export of frame phases and worker threads (--trace=file.json)
+ *   - Per-subsystem memory counters; chart history decimated to a budget (--mem-budget)
+ *   - Huge-page backed disk and grid arrays, first-touched by worker threads (--huge-pages)
+ *   - Shared work-stealing thread pool sized to the CPU quota (--threads, --pin-threads)
+ *   - Frames run as a task graph: step t+1 overlaps statistics and drawing prep for step t
+ *   - Per-frame arena for transient vertices and strings; labels kept across frames
+ *   - Compact 16-byte disks: fixed-point position and velocity, per-species radius (--compact)
+ *   - Headless out-of-core runs over memory-mapped tile files (--tiles=DIR)
+ *   - Live samples and frames in a shared-memory ring for other processes (--shm=NAME)
+ *   - Server hosting many headless runs behind a UNIX socket (--serve=SOCKET)
+ *   - Startup tuning of broad-phase cell size and thread count, cached per machine (--tune)
+ *   - Output written asynchronously from page-aligned buffers (io_uring or a pwrite thread)
  */
 
 #include <SFML/Graphics.hpp>
@@ -17,6 +44,47 @@
 #include <iostream>
 #include <sstream>
 #include <iomanip>  // for std::setprecision
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <deque>
+#include <array>
+#include <fstream>
+#include <cctype>
+#include <unordered_map>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <cstdarg>
+#include <cstddef>
+#include <cerrno>
+#if defined(__linux__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <csignal>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define DISK_SIM_IO_URING 1
+#endif
+#endif
+#endif
+#include <chrono>
+#include <memory>
+#include <mutex>
 
 // ---------------------
 // GLOBAL CONSTANTS
@@ -36,20 +104,1062 @@ static const float CHART_HEIGHT = 200.f;
 // Global speed factor changed by Up/Down arrow
 static float g_speedFactor = 5.0f; // 1.0 = normal speed
 
+// ---------------------
+// RUNTIME OPTIONS (see parse_args)
+// ---------------------
+enum class Engine {
+    Reference,  // original all-pairs loop over handle_disk_collision
+    Geometric,  // same pair test, candidates from the grid broad phase
+    DSMC        // Bird-style direct simulation Monte Carlo per cell
+};
+static Engine g_engine     = Engine::Geometric;
+static int    g_diskCount  = DISK_COUNT;
+static int    g_diskRadius = DISK_RADIUS;
+static int    g_totalCoins = 8;      // dealt MAX_COINS_PER_DISK at a time from disk 0
+static float  g_dsmcCell   = 0.f;    // DSMC cell size in px, 0 = 4 * radius
+static long long g_latticeAgents  = 0;      // lattice-gas companion agents, 0 = off
+static float     g_latticeDensity = 0.25f;  // fraction of lattice cells occupied
+static std::string g_graphPath;              // edge list for the graph engine, empty = off
+static int         g_graphBatch = 65536;     // edges sampled per graph step
+static int         g_windowSamples = 2048;   // equilibrated averaging window
+static std::string g_exportPath;             // histogram CSV written on exit, empty = off
+static std::string g_initPath;               // histogram CSV to warm-start from, empty = off
+static bool        g_velocityChart = false;  // third window with the speed histogram
+static float       g_rdfRange = 0.f;         // g(r) range in px, 0 = 4 * radius
+static std::string g_rdfExportPath;          // g(r) CSV written on exit, empty = off
+static double      g_targetError = 0.0;      // stop once every fraction's error is below, 0 = off
+static bool        g_printReference = false; // print the exact reference and exit
+static bool        g_seedSet = false;        // --seed given: reproducible rng and rand()
+static unsigned    g_seed    = 0;
+static bool        g_checkEngines = false;   // run the engine equivalence check and exit
+static int         g_checkSnapshots = 4000;  // snapshots per engine in the check
+static float       g_fixedDt = 0.f;          // physics step in seconds, 0 = wall clock
+static std::string g_digestPath;             // per-step state digests, empty = off
+static std::string g_compareDigests;         // "A,B": compare two digest files and exit
+static std::string g_tracePath;              // Chrome trace JSON written on exit, empty = off
+static double      g_memBudget = 0.0;        // tracked bytes before history decimation, 0 = off
+enum class HugePages {
+    Off,        // plain anonymous mappings
+    Thp,        // madvise(MADV_HUGEPAGE): transparent huge pages
+    Explicit    // MAP_HUGETLB from the reserved pool, THP if that fails
+};
+static HugePages   g_hugePages = HugePages::Thp;
+static int         g_threads = 0;            // pool threads including main, 0 = CPUs available
+static bool        g_pinThreads = false;     // pin pool threads to the allowed CPUs
+static bool        g_compact = false;        // 16-byte quantized disks (geometric engine)
+static std::string g_tileDir;                // out-of-core tile files, empty = in memory
+static int         g_tileCount = 16;         // bands of broad-phase rows
+static int         g_residentTiles = 4;      // tiles mapped at once, at least 3
+static long long   g_steps = 1000;           // steps for a headless tiled run
+static bool        g_ioUring = true;         // async output through io_uring when available
+static std::string g_shmName;                // shared-memory ring for live readers, empty = none
+static bool        g_shmDisks = false;       // also publish each frame's disks to the ring
+static std::string g_shmRead;                // follow another run's ring instead of simulating
+static std::string g_servePath;              // host runs behind this UNIX socket, empty = off
+static std::string g_serveDir;               // server snapshots go here, empty = no snapshots
+static float       g_cellSize = 0.f;         // broad-phase cell in px, 0 = the g(r) range
+static bool        g_tune = false;           // time cell sizes and pool sizes at startup
+
+// -------------------------------------------------------------
+// Tracing (--trace=FILE): one complete event per TraceScope,
+// written on exit as Chrome trace JSON (chrome://tracing and
+// ui.perfetto.dev both open it)
+// -------------------------------------------------------------
+static const size_t TRACE_MAX_EVENTS = 1 << 20;  // per thread; later events are dropped
+
+struct TraceEvent {
+    const char *name;   // string literal
+    int64_t beginNs;
+    int64_t durNs;
+};
+
+// Appended to by one thread at a time without locking. A thread takes a
+// free buffer (or adds one) under g_traceMutex on its first event and hands
+// it back on exit, so short-lived workers reuse the same timeline rows.
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    uint32_t  tid = 0;
+    long long dropped = 0;
+    bool      inUse = false;
+};
+
+struct TraceHandle {
+    TraceBuffer *buffer = nullptr;
+    ~TraceHandle();
+};
+
+static bool g_traceEnabled = false;  // set before any worker starts
+static std::chrono::steady_clock::time_point g_traceStart;
+static std::mutex g_traceMutex;
+static std::vector<std::unique_ptr<TraceBuffer>> g_traceBuffers;
+
+TraceHandle::~TraceHandle() {
+    if (buffer) {
+        std::lock_guard<std::mutex> lock(g_traceMutex);
+        buffer->inUse = false;
+    }
+}
+
+static int64_t trace_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - g_traceStart).count();
+}
+
+static TraceBuffer &trace_buffer() {
+    thread_local TraceHandle handle;
+    if (!handle.buffer) {
+        std::lock_guard<std::mutex> lock(g_traceMutex);
+        for (auto &b : g_traceBuffers) {
+            if (!b->inUse) {
+                handle.buffer = b.get();
+                break;
+            }
+        }
+        if (!handle.buffer) {
+            g_traceBuffers.push_back(std::make_unique<TraceBuffer>());
+            handle.buffer = g_traceBuffers.back().get();
+            handle.buffer->tid = (uint32_t)g_traceBuffers.size();
+            handle.buffer->events.reserve(4096);
+        }
+        handle.buffer->inUse = true;
+    }
+    return *handle.buffer;
+}
+
+// Times its own lifetime; a single branch when tracing is off
+struct TraceScope {
+    const char *name;
+    int64_t     begin = -1;
+
+    explicit TraceScope(const char *n) : name(n) {
+        if (g_traceEnabled) begin = trace_now();
+    }
+    ~TraceScope() {
+        if (begin < 0) return;
+        TraceBuffer &b = trace_buffer();
+        if (b.events.size() < TRACE_MAX_EVENTS) {
+            b.events.push_back({name, begin, trace_now() - begin});
+        } else {
+            b.dropped++;
+        }
+    }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+};
+
+// Start the clock and claim the first buffer (tid 1) for the main thread
+void trace_begin() {
+    g_traceStart = std::chrono::steady_clock::now();
+    g_traceEnabled = true;
+    trace_buffer();
+}
+
+// Write every buffer as "X" (complete) events; call after workers have joined
+bool write_trace(const std::string &path) {
+    FILE *f = std::fopen(path.c_str(), "w");
+    if (!f) return false;
+    std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    std::fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+                    "\"args\":{\"name\":\"disk_sim\"}}");
+    long long dropped = 0;
+    for (auto &b : g_traceBuffers) {
+        if (b->tid == 1) {
+            std::fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+                            "\"args\":{\"name\":\"main\"}}");
+        } else {
+            std::fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                            "\"args\":{\"name\":\"worker %u\"}}", b->tid, b->tid - 1);
+        }
+        for (const TraceEvent &e : b->events) {
+            std::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                            "\"ts\":%.3f,\"dur\":%.3f}",
+                         e.name, b->tid, e.beginNs * 1e-3, e.durNs * 1e-3);
+        }
+        dropped += b->dropped;
+    }
+    std::fprintf(f, "\n]}\n");
+    if (dropped > 0) {
+        std::cerr << "Trace buffers full: " << dropped << " events dropped\n";
+    }
+    return std::fclose(f) == 0;
+}
+
+// -------------------------------------------------------------
+// Thread pool: one work-stealing pool for every parallel pass
+//
+// Worker 0 is the thread that calls pool_start (main); it runs tasks
+// while it waits. Each worker pops its own deque from the back and
+// steals from the front of the others. parallel_for queues chunk t
+// on worker t, so passes over the same range keep their placement,
+// and the chunk index (not the worker) selects per-chunk rngs and
+// partial sums, which keeps results independent of scheduling.
+// -------------------------------------------------------------
+struct ThreadPool {
+    struct Queue {
+        std::mutex m;
+        std::deque<std::function<void()>> tasks;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;  // one per worker
+    std::vector<std::thread> threads;            // workers 1..n-1
+    std::mutex              sleepMutex;
+    std::condition_variable wake;
+    long long queued = 0;                        // guarded by sleepMutex
+    bool      stop   = false;
+
+    ~ThreadPool();
+};
+static ThreadPool g_pool;
+static thread_local int t_poolWorker = 0;
+
+int pool_size() {
+    return std::max(1, (int)g_pool.queues.size());
+}
+
+// CPUs this process may run on: the affinity mask, capped by a cgroup
+// CPU quota (v2 cpu.max or v1 cfs_quota_us / cfs_period_us)
+int available_cpus(std::vector<int> *cpuList = nullptr) {
+    int cpus = (int)std::max(1u, std::thread::hardware_concurrency());
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        cpus = std::max(1, CPU_COUNT(&set));
+        if (cpuList) {
+            for (int c = 0; c < CPU_SETSIZE; c++) {
+                if (CPU_ISSET(c, &set)) cpuList->push_back(c);
+            }
+        }
+    }
+    long long quota = -1, period = 0;
+    if (FILE *f = std::fopen("/sys/fs/cgroup/cpu.max", "r")) {
+        char q[32] = {0};
+        if (std::fscanf(f, "%31s %lld", q, &period) == 2 && std::strcmp(q, "max") != 0) {
+            quota = std::atoll(q);
+        }
+        std::fclose(f);
+    } else if (FILE *fq = std::fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) {
+        if (std::fscanf(fq, "%lld", &quota) != 1) quota = -1;
+        std::fclose(fq);
+        if (FILE *fp = std::fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")) {
+            if (std::fscanf(fp, "%lld", &period) != 1) period = 0;
+            std::fclose(fp);
+        }
+    }
+    if (quota > 0 && period > 0) {
+        cpus = std::min(cpus, (int)std::max(1LL, (quota + period - 1) / period));
+    }
+#endif
+    return cpus;
+}
+
+static void pool_pin(std::thread::native_handle_type handle, int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(handle, sizeof(set), &set);
+#else
+    (void)handle;
+    (void)cpu;
+#endif
+}
+
+void pool_submit(std::function<void()> task, int worker) {
+    ThreadPool &p = g_pool;
+    if (p.queues.empty()) {
+        task();
+        return;
+    }
+    ThreadPool::Queue &q = *p.queues[worker % p.queues.size()];
+    {
+        std::lock_guard<std::mutex> lock(q.m);
+        q.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(p.sleepMutex);
+        p.queued++;
+    }
+    p.wake.notify_one();
+}
+
+// Run one queued task (own deque first, then steal); false if none found
+static bool pool_run_one(int self) {
+    ThreadPool &p = g_pool;
+    int n = (int)p.queues.size();
+    std::function<void()> task;
+    for (int k = 0; k < n && !task; k++) {
+        ThreadPool::Queue &q = *p.queues[(self + k) % n];
+        std::lock_guard<std::mutex> lock(q.m);
+        if (q.tasks.empty()) continue;
+        if (k == 0) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        } else {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+    }
+    if (!task) return false;
+    {
+        std::lock_guard<std::mutex> lock(p.sleepMutex);
+        p.queued--;
+    }
+    task();
+    return true;
+}
+
+// Help with queued work until `pending` drops to zero
+void pool_wait(const std::atomic<int> &pending) {
+    while (pending.load(std::memory_order_acquire) > 0) {
+        if (!pool_run_one(t_poolWorker)) std::this_thread::yield();
+    }
+}
+
+static void pool_worker(int self) {
+    t_poolWorker = self;
+    ThreadPool &p = g_pool;
+    for (;;) {
+        if (pool_run_one(self)) continue;
+        std::unique_lock<std::mutex> lock(p.sleepMutex);
+        p.wake.wait(lock, [&] { return p.stop || p.queued > 0; });
+        if (p.stop && p.queued == 0) return;
+    }
+}
+
+// threads <= 0 uses available_cpus(); the caller becomes worker 0
+void pool_start(int threads, bool pin) {
+    std::vector<int> cpuList;
+    int cpus = available_cpus(&cpuList);
+    int n = threads > 0 ? threads : cpus;
+    for (int i = 0; i < n; i++) {
+        g_pool.queues.push_back(std::make_unique<ThreadPool::Queue>());
+    }
+    for (int i = 1; i < n; i++) {
+        g_pool.threads.emplace_back(pool_worker, i);
+    }
+    if (pin && !cpuList.empty()) {
+        pool_pin(pthread_self(), cpuList[0]);
+        for (int i = 1; i < n; i++) {
+            pool_pin(g_pool.threads[i - 1].native_handle(), cpuList[i % cpuList.size()]);
+        }
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto &th : threads) th.join();
+}
+
+// Join the workers and drop the queues, so pool_start can run again
+void pool_stop() {
+    ThreadPool &p = g_pool;
+    {
+        std::lock_guard<std::mutex> lock(p.sleepMutex);
+        p.stop = true;
+    }
+    p.wake.notify_all();
+    for (auto &th : p.threads) th.join();
+    p.threads.clear();
+    p.queues.clear();
+    p.stop = false;
+}
+
+// Smallest chunk worth a task for per-disk loops
+static const size_t PARALLEL_MIN_CHUNK = 4096;
+
+// Split [0, n) into at most pool_size() contiguous chunks of at least
+// minChunk items and call fn(from, to, chunk) on each; inline if one chunk
+template <class F>
+void parallel_for(size_t n, size_t minChunk, F fn) {
+    size_t chunks = std::min<size_t>(pool_size(), (n + minChunk - 1) / std::max<size_t>(1, minChunk));
+    if (chunks <= 1) {
+        if (n > 0) fn((size_t)0, n, 0);
+        return;
+    }
+    size_t size = (n + chunks - 1) / chunks;
+    std::atomic<int> pending((int)chunks);
+    for (size_t t = 0; t < chunks; t++) {
+        pool_submit([&, t] {
+            fn(t * size, std::min(n, (t + 1) * size), (int)t);
+            pending.fetch_sub(1, std::memory_order_release);
+        }, (int)t);
+    }
+    pool_wait(pending);
+}
+
+// A dependency graph of tasks: add() nodes with the ids they wait on,
+// then run() queues every node once its dependencies have finished
+struct TaskGraph {
+    struct Node {
+        std::function<void()> fn;
+        std::vector<int>      successors;
+        int                   deps = 0;
+        std::atomic<int>      pending{0};
+    };
+    std::deque<Node> nodes;
+
+    int add(std::function<void()> fn, std::initializer_list<int> after = {}) {
+        nodes.emplace_back();
+        Node &node = nodes.back();
+        node.fn = std::move(fn);
+        int id = (int)nodes.size() - 1;
+        for (int d : after) {
+            nodes[d].successors.push_back(id);
+            node.deps++;
+        }
+        return id;
+    }
+
+    void run() {
+        std::atomic<int> remaining((int)nodes.size());
+        std::function<void(int)> launch = [&](int i) {
+            pool_submit([&, i] {
+                nodes[i].fn();
+                for (int s : nodes[i].successors) {
+                    if (nodes[s].pending.fetch_sub(1, std::memory_order_acq_rel) == 1) launch(s);
+                }
+                remaining.fetch_sub(1, std::memory_order_release);
+            }, t_poolWorker);
+        };
+        for (auto &node : nodes) node.pending.store(node.deps, std::memory_order_relaxed);
+        for (int i = 0; i < (int)nodes.size(); i++) {
+            if (nodes[i].deps == 0) launch(i);
+        }
+        pool_wait(remaining);
+    }
+};
+
+// -------------------------------------------------------------
+// Memory accounting: containers that can grow with the disk count
+// or the run length allocate through TrackedAllocator, which keeps
+// live bytes and allocations per subsystem tag.
+// -------------------------------------------------------------
+enum MemTag {
+    MEM_HISTORY,      // chart history (xdata / ydata, companion series)
+    MEM_DISKS,        // the disk store
+    MEM_BROAD_PHASE,  // cell grids, DSMC cells, g(r) bins
+    MEM_STATISTICS,   // occupancy counters, quantile trees, blocking, window ring
+    MEM_COMPANIONS,   // lattice gas and graph engine
+    MEM_RENDER,       // frame arena
+    MEM_OUTPUT,       // async writer buffers
+    MEM_TAGS
+};
+static const char *MEM_TAG_NAMES[MEM_TAGS] = {
+    "chart history", "disks", "broad phase", "statistics", "companions", "render", "output"
+};
+
+struct MemCounter {
+    std::atomic<long long> bytes{0};
+    std::atomic<long long> allocations{0};
+};
+static MemCounter g_memory[MEM_TAGS];
+
+// Blocks of at least one huge page taken by a Huge allocator are mapped
+// directly, 2 MB aligned, so the kernel can back them with huge pages.
+// The decision depends only on the size, so deallocation can repeat it.
+static const size_t HUGE_PAGE_BYTES = 2u << 20;
+
+static size_t huge_length(size_t bytes) {
+    return (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+}
+
+static void *huge_map(size_t bytes) {
+#ifdef __linux__
+    size_t length = huge_length(bytes);
+#ifdef MAP_HUGETLB
+    if (g_hugePages == HugePages::Explicit) {
+        void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) return p;
+    }
+#endif
+    // Over-map by one huge page and trim both ends to a 2 MB boundary
+    void *raw = mmap(nullptr, length + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) throw std::bad_alloc();
+    uintptr_t start = ((uintptr_t)raw + HUGE_PAGE_BYTES - 1) & ~(uintptr_t)(HUGE_PAGE_BYTES - 1);
+    size_t head = start - (uintptr_t)raw;
+    if (head > 0) munmap(raw, head);
+    if (HUGE_PAGE_BYTES - head > 0) munmap((char *)start + length, HUGE_PAGE_BYTES - head);
+#ifdef MADV_HUGEPAGE
+    if (g_hugePages != HugePages::Off) madvise((void *)start, length, MADV_HUGEPAGE);
+#endif
+    return (void *)start;
+#else
+    return ::operator new(bytes);
+#endif
+}
+
+static void huge_unmap(void *p, size_t bytes) {
+#ifdef __linux__
+    munmap(p, huge_length(bytes));
+#else
+    ::operator delete(p);
+    (void)bytes;
+#endif
+}
+
+template <class T, int Tag, bool Huge = false>
+struct TrackedAllocator {
+    using value_type = T;
+    template <class U> struct rebind { using other = TrackedAllocator<U, Tag, Huge>; };
+
+    TrackedAllocator() = default;
+    template <class U> TrackedAllocator(const TrackedAllocator<U, Tag, Huge> &) {}
+
+    T *allocate(size_t n) {
+        T *p = (Huge && n * sizeof(T) >= HUGE_PAGE_BYTES)
+             ? static_cast<T *>(huge_map(n * sizeof(T)))
+             : std::allocator<T>().allocate(n);
+        g_memory[Tag].bytes.fetch_add((long long)(n * sizeof(T)), std::memory_order_relaxed);
+        g_memory[Tag].allocations.fetch_add(1, std::memory_order_relaxed);
+        return p;
+    }
+    void deallocate(T *p, size_t n) {
+        g_memory[Tag].bytes.fetch_sub((long long)(n * sizeof(T)), std::memory_order_relaxed);
+        g_memory[Tag].allocations.fetch_sub(1, std::memory_order_relaxed);
+        if (Huge && n * sizeof(T) >= HUGE_PAGE_BYTES) {
+            huge_unmap(p, n * sizeof(T));
+        } else {
+            std::allocator<T>().deallocate(p, n);
+        }
+    }
+
+    // Huge arrays default-initialise on resize, so their pages stay
+    // untouched until first_touch hands them to the owning workers
+    template <class U, bool H = Huge, class = typename std::enable_if<H>::type>
+    void construct(U *p) { ::new ((void *)p) U; }
+};
+template <class T, class U, int Tag, bool Huge>
+bool operator==(const TrackedAllocator<T, Tag, Huge> &, const TrackedAllocator<U, Tag, Huge> &) { return true; }
+template <class T, class U, int Tag, bool Huge>
+bool operator!=(const TrackedAllocator<T, Tag, Huge> &, const TrackedAllocator<U, Tag, Huge> &) { return false; }
+
+template <class T, int Tag>
+using TrackedVector = std::vector<T, TrackedAllocator<T, Tag>>;
+template <class T, int Tag>
+using HugeVector = std::vector<T, TrackedAllocator<T, Tag, true>>;
+
+// Write one byte per page through parallel_for, so chunk t (and each page
+// in it) is faulted in on the NUMA node of worker t, which later steps the
+// same chunk. Call before the array is filled; small arrays are left to
+// whoever writes them first.
+template <class V>
+void first_touch(V &v) {
+    static const size_t FIRST_TOUCH_MIN = 16 * HUGE_PAGE_BYTES;
+    size_t item = sizeof(typename V::value_type);
+    if (v.size() * item < FIRST_TOUCH_MIN) return;
+
+    char *base = reinterpret_cast<char *>(v.data());
+    parallel_for(v.size(), PARALLEL_MIN_CHUNK, [&](size_t from, size_t to, int) {
+        for (size_t b = from * item; b < to * item; b += 4096) base[b] = 0;
+    });
+}
+using HistoryVector = TrackedVector<float, MEM_HISTORY>;
+
+long long memory_total() {
+    long long total = 0;
+    for (auto &m : g_memory) total += m.bytes.load(std::memory_order_relaxed);
+    return total;
+}
+
+// Resident set size in bytes from /proc, or -1 where that isn't available
+long long memory_resident() {
+#ifdef __linux__
+    long long pages = 0, resident = 0;
+    FILE *f = std::fopen("/proc/self/statm", "r");
+    if (!f) return -1;
+    int got = std::fscanf(f, "%lld %lld", &pages, &resident);
+    std::fclose(f);
+    if (got != 2) return -1;
+    return resident * sysconf(_SC_PAGESIZE);
+#else
+    return -1;
+#endif
+}
+
+std::string format_bytes(double bytes) {
+    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    int u = 0;
+    while (bytes >= 1024.0 && u < 4) {
+        bytes /= 1024.0;
+        u++;
+    }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), u == 0 ? "%.0f %s" : "%.1f %s", bytes, units[u]);
+    return buf;
+}
+
+// -------------------------------------------------------------
+// Asynchronous file output (--digest, --export, --export-rdf)
+//
+// AsyncFile is a streambuf whose put area is a page-aligned buffer
+// from a shared pool. A full buffer goes to the writer at its file
+// offset and the producer carries on in the next one, so it only
+// waits when all OUTPUT_BUFFERS are in flight. Writes go through
+// io_uring where the kernel allows it (raw syscalls, no liburing),
+// otherwise through a writer thread calling pwrite.
+//
+// The fallback writer is its own thread, not pool_submit work. Worker
+// 0 is main, which runs queued tasks only inside pool_wait: with
+// --threads=1 a write queued there would never run while main blocks
+// in output_acquire for a free buffer. On larger pools a task stuck in
+// pwrite would hold a worker that the next parallel_for places chunks
+// on, and pool_stop (--tune restarts the pool) drops queued tasks.
+// -------------------------------------------------------------
+static const size_t OUTPUT_PAGE         = 4096;
+static const size_t OUTPUT_BUFFER_BYTES = 256 * 1024;   // multiple of OUTPUT_PAGE
+static const int    OUTPUT_BUFFERS      = 8;
+
+struct AsyncFile;
+
+struct OutputBuffer {
+    TrackedVector<char, MEM_OUTPUT> storage;    // one page extra for alignment
+    char      *data = nullptr;                  // page aligned
+    size_t     used = 0, written = 0;
+    AsyncFile *file = nullptr;
+    off_t      offset = 0;                      // file offset of data[0]
+};
+
+#ifdef DISK_SIM_IO_URING
+struct IoRing {
+    int fd = -1;
+    unsigned entries = 0;
+    unsigned *sqHead = nullptr, *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+    unsigned *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    void  *sqMap = MAP_FAILED, *cqMap = MAP_FAILED, *sqeMap = MAP_FAILED;
+    size_t sqBytes = 0, cqBytes = 0, sqeBytes = 0;
+};
+
+static void ring_teardown(IoRing &r) {
+    if (r.sqeMap != MAP_FAILED) munmap(r.sqeMap, r.sqeBytes);
+    if (r.cqMap != MAP_FAILED && r.cqMap != r.sqMap) munmap(r.cqMap, r.cqBytes);
+    if (r.sqMap != MAP_FAILED) munmap(r.sqMap, r.sqBytes);
+    if (r.fd >= 0) close(r.fd);
+    r = IoRing();
+}
+
+static bool ring_setup(IoRing &r, unsigned entries) {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    r.fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r.fd < 0) return false;
+    r.entries = p.sq_entries;
+    r.sqBytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r.cqBytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) r.sqBytes = r.cqBytes = std::max(r.sqBytes, r.cqBytes);
+    r.sqMap = mmap(nullptr, r.sqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r.fd, IORING_OFF_SQ_RING);
+    r.cqMap = single ? r.sqMap
+                     : mmap(nullptr, r.cqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            r.fd, IORING_OFF_CQ_RING);
+    r.sqeBytes = p.sq_entries * sizeof(io_uring_sqe);
+    r.sqeMap = mmap(nullptr, r.sqeBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    r.fd, IORING_OFF_SQES);
+    if (r.sqMap == MAP_FAILED || r.cqMap == MAP_FAILED || r.sqeMap == MAP_FAILED) {
+        ring_teardown(r);
+        return false;
+    }
+    char *sq = static_cast<char *>(r.sqMap);
+    char *cq = static_cast<char *>(r.cqMap);
+    r.sqHead  = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    r.sqTail  = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    r.sqMask  = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    r.sqArray = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    r.cqHead  = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    r.cqTail  = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    r.cqMask  = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    r.cqes    = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+    r.sqes    = static_cast<io_uring_sqe *>(r.sqeMap);
+    return true;
+}
+
+// Queue one write (or, for a null buffer, the NOP that stops the
+// reaper) and enter the kernel. The caller holds g_output.mutex.
+// Returns true once the kernel owns the entry. Without SQPOLL the
+// kernel reads the SQ only inside io_uring_enter, and those calls are
+// serialised by the mutex, so an entry a failed enter did not consume
+// is withdrawn: on false the caller may reuse the buffer at once.
+static bool ring_submit(IoRing &r, int fd, const OutputBuffer *b) {
+    unsigned tail = *r.sqTail;
+    if (tail - __atomic_load_n(r.sqHead, __ATOMIC_ACQUIRE) >= r.entries) return false;
+    unsigned idx = tail & *r.sqMask;
+    io_uring_sqe &sqe = r.sqes[idx];
+    std::memset(&sqe, 0, sizeof(sqe));
+    if (b) {
+        sqe.opcode    = IORING_OP_WRITE;
+        sqe.fd        = fd;
+        sqe.addr      = (uint64_t)(uintptr_t)(b->data + b->written);
+        sqe.len       = (unsigned)(b->used - b->written);
+        sqe.off       = (uint64_t)(b->offset + (off_t)b->written);
+        sqe.user_data = (uint64_t)(uintptr_t)b;
+    } else {
+        sqe.opcode = IORING_OP_NOP;
+    }
+    r.sqArray[idx] = idx;
+    __atomic_store_n(r.sqTail, tail + 1, __ATOMIC_RELEASE);
+    long n;
+    do {
+        n = syscall(__NR_io_uring_enter, r.fd, 1, 0, 0, nullptr, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n == 1 || __atomic_load_n(r.sqHead, __ATOMIC_ACQUIRE) == tail + 1) return true;
+    __atomic_store_n(r.sqTail, tail, __ATOMIC_RELEASE);
+    return false;
+}
+#endif
+
+struct OutputWriter {
+    std::mutex mutex;
+    std::condition_variable idleCv;    // a buffer came back
+    std::condition_variable workCv;    // pwrite thread: queue or stop
+    std::vector<std::unique_ptr<OutputBuffer>> buffers;
+    std::vector<OutputBuffer *> idle;
+    std::deque<OutputBuffer *>  queue;  // pwrite thread's work
+    std::thread thread;                 // pwrite thread or io_uring reaper
+    bool started = false;
+    bool stop    = false;
+#ifdef DISK_SIM_IO_URING
+    IoRing ring;
+    bool   uring = false;
+#endif
+
+    ~OutputWriter() {
+        if (!started) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        workCv.notify_all();
+#ifdef DISK_SIM_IO_URING
+        // The reaper only wakes for a completion, so retry the NOP (with the
+        // lock dropped, so the reaper can drain the CQ); if the ring never
+        // takes it, leave the reaper blocked rather than hang at exit
+        bool queued = !uring;
+        for (int tries = 0; !queued && tries < 1000; tries++) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queued = ring_submit(ring, -1, nullptr);
+            }
+            if (!queued) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (!queued) {
+            thread.detach();
+            return;
+        }
+#endif
+        if (thread.joinable()) thread.join();
+#ifdef DISK_SIM_IO_URING
+        ring_teardown(ring);
+#endif
+    }
+};
+static OutputWriter g_output;
+
+struct AsyncFile : std::streambuf {
+    int   fd = -1;
+    off_t offset = 0;                 // file offset of the current buffer
+    OutputBuffer *buffer = nullptr;   // put area
+    int   inFlight = 0;               // guarded by g_output.mutex
+    bool  failed   = false;           // guarded by g_output.mutex
+
+    ~AsyncFile() override { close(); }
+    bool open(const std::string &path);
+    bool close();
+    void submit();
+    int overflow(int c) override;
+    int sync() override;
+};
+
+// A buffer is done, written or failed. The caller holds g_output.mutex.
+static void output_finish_locked(OutputBuffer *b, bool ok) {
+    if (!ok) b->file->failed = true;
+    b->file->inFlight--;
+    b->file = nullptr;
+    g_output.idle.push_back(b);
+    g_output.idleCv.notify_all();
+}
+
+static bool output_pwrite(OutputBuffer *b) {
+#if defined(__linux__) || defined(__APPLE__)
+    while (b->written < b->used) {
+        ssize_t n = pwrite(b->file->fd, b->data + b->written, b->used - b->written,
+                           b->offset + (off_t)b->written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        b->written += (size_t)n;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void output_thread() {
+    for (;;) {
+        OutputBuffer *b;
+        {
+            std::unique_lock<std::mutex> lock(g_output.mutex);
+            g_output.workCv.wait(lock, [] { return g_output.stop || !g_output.queue.empty(); });
+            if (g_output.queue.empty()) return;
+            b = g_output.queue.front();
+            g_output.queue.pop_front();
+        }
+        bool ok = output_pwrite(b);
+        std::lock_guard<std::mutex> lock(g_output.mutex);
+        output_finish_locked(b, ok);
+    }
+}
+
+#ifdef DISK_SIM_IO_URING
+// Completions: short writes go back in for the rest, and anything the
+// ring refuses (an old kernel without IORING_OP_WRITE) is finished
+// with pwrite; the NOP from ~OutputWriter ends the loop
+static void ring_reaper() {
+    IoRing &r = g_output.ring;
+    for (;;) {
+        long n = syscall(__NR_io_uring_enter, r.fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (n < 0 && errno != EINTR) return;
+        bool quit = false;
+        std::lock_guard<std::mutex> lock(g_output.mutex);
+        unsigned head = *r.cqHead;
+        unsigned tail = __atomic_load_n(r.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const io_uring_cqe &cqe = r.cqes[head & *r.cqMask];
+            OutputBuffer *b = reinterpret_cast<OutputBuffer *>((uintptr_t)cqe.user_data);
+            if (!b) {
+                quit = true;
+                continue;
+            }
+            if (cqe.res > 0) b->written += (size_t)cqe.res;
+            if (cqe.res > 0 && b->written < b->used && ring_submit(r, b->file->fd, b)) continue;
+            output_finish_locked(b, output_pwrite(b));
+        }
+        __atomic_store_n(r.cqHead, head, __ATOMIC_RELEASE);
+        if (quit) return;
+    }
+}
+#endif
+
+// Buffers and the writer thread, on the first open (main thread)
+static void output_start() {
+    if (g_output.started) return;
+    g_output.started = true;
+    for (int i = 0; i < OUTPUT_BUFFERS; i++) {
+        g_output.buffers.emplace_back(new OutputBuffer());
+        OutputBuffer &b = *g_output.buffers.back();
+        b.storage.resize(OUTPUT_BUFFER_BYTES + OUTPUT_PAGE);
+        b.data = reinterpret_cast<char *>(((uintptr_t)b.storage.data() + OUTPUT_PAGE - 1) &
+                                          ~(uintptr_t)(OUTPUT_PAGE - 1));
+        g_output.idle.push_back(&b);
+    }
+#ifdef DISK_SIM_IO_URING
+    // One entry per buffer in flight, one for a resubmitted short write, one for the NOP
+    if (g_ioUring && ring_setup(g_output.ring, 2 * OUTPUT_BUFFERS + 2)) {
+        g_output.uring  = true;
+        g_output.thread = std::thread(ring_reaper);
+        return;
+    }
+#endif
+    g_output.thread = std::thread(output_thread);
+}
+
+// Backpressure: wait only when every buffer is in flight
+static OutputBuffer *output_acquire(AsyncFile *file) {
+    std::unique_lock<std::mutex> lock(g_output.mutex);
+    g_output.idleCv.wait(lock, [] { return !g_output.idle.empty(); });
+    OutputBuffer *b = g_output.idle.back();
+    g_output.idle.pop_back();
+    b->used = b->written = 0;
+    b->file = file;
+    return b;
+}
+
+static void output_release(OutputBuffer *b) {
+    std::lock_guard<std::mutex> lock(g_output.mutex);
+    b->file = nullptr;
+    g_output.idle.push_back(b);
+    g_output.idleCv.notify_all();
+}
+
+static void output_submit(OutputBuffer *b) {
+    std::lock_guard<std::mutex> lock(g_output.mutex);
+    b->file->inFlight++;
+#ifdef DISK_SIM_IO_URING
+    if (g_output.uring) {
+        if (!ring_submit(g_output.ring, b->file->fd, b)) {
+            output_finish_locked(b, output_pwrite(b));   // ring refused: write inline
+        }
+        return;
+    }
+#endif
+    g_output.queue.push_back(b);
+    g_output.workCv.notify_one();
+}
+
+bool AsyncFile::open(const std::string &path) {
+    close();
+#if defined(__linux__) || defined(__APPLE__)
+    output_start();
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0) return false;
+    offset = 0;
+    failed = false;
+    buffer = output_acquire(this);
+    setp(buffer->data, buffer->data + OUTPUT_BUFFER_BYTES);
+    return true;
+}
+
+// Hand the put area to the writer and continue in a fresh buffer
+void AsyncFile::submit() {
+    size_t used = (size_t)(pptr() - pbase());
+    if (used == 0) return;
+    buffer->used   = used;
+    buffer->offset = offset;
+    offset += (off_t)used;
+    output_submit(buffer);
+    buffer = output_acquire(this);
+    setp(buffer->data, buffer->data + OUTPUT_BUFFER_BYTES);
+}
+
+int AsyncFile::overflow(int c) {
+    if (fd < 0) return traits_type::eof();
+    submit();
+    if (c != traits_type::eof()) {
+        *pptr() = (char)c;
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int AsyncFile::sync() {
+    if (fd < 0) return -1;
+    submit();
+    return 0;
+}
+
+// Flush, wait for this file's writes and close; false if any failed
+bool AsyncFile::close() {
+    if (fd < 0) return true;
+    size_t used = (size_t)(pptr() - pbase());
+    buffer->used   = used;
+    buffer->offset = offset;
+    if (used > 0) {
+        output_submit(buffer);
+    } else {
+        output_release(buffer);
+    }
+    buffer = nullptr;
+    setp(nullptr, nullptr);
+    bool ok;
+    {
+        std::unique_lock<std::mutex> lock(g_output.mutex);
+        g_output.idleCv.wait(lock, [this] { return inFlight == 0; });
+        ok = !failed;
+    }
+#if defined(__linux__) || defined(__APPLE__)
+    ok = ::close(fd) == 0 && ok;
+#endif
+    fd = -1;
+    return ok;
+}
+
+// std::ofstream look-alike over an AsyncFile
+struct AsyncOfstream : std::ostream {
+    AsyncFile file;
+
+    AsyncOfstream() : std::ostream(nullptr) { rdbuf(&file); }
+    explicit AsyncOfstream(const std::string &path) : AsyncOfstream() { open(path); }
+
+    void open(const std::string &path) {
+        if (!file.open(path)) setstate(std::ios::failbit);
+    }
+    bool is_open() const { return file.fd >= 0; }
+    bool close() {
+        if (!file.close()) setstate(std::ios::badbit);
+        return !fail();
+    }
+};
+
 // ---------------------
 // GLOBALS FOR CHART
 // ---------------------
-static int collision_count = 0;  // track total collisions
+static long long collision_count = 0;  // track total collisions
+static long long step_count = 0; // physics steps taken
 
 // Each coin count (0..8): store x (collision_count) and fraction
-static std::vector<float> xdata[9];
-static std::vector<float> ydata[9];
-static std::vector<int>   cumulative_counts(9, 0);
+static HistoryVector xdata[9];
+static HistoryVector ydata[9];
+static std::vector<long long> cumulative_counts(9, 0);
+
+// Exact expected number of disks holding 0..8 coins (see exact_reference)
+static double g_exactReference[9] = {0.0};
+
+// Total number of update_plot samples (cumulative_counts covers all of them)
+static long long sample_count = 0;
+
+// Latest ergodicity gap (mean / max TV distance), refreshed per sample
+static double g_ergodicityGapMean = 0.0;
+static double g_ergodicityGapMax  = 0.0;
 
 // We'll also store the latest fraction for each coin count (0..8),
 // so we can display them in the second window (3 decimal places).
 static float g_coinFraction[9] = {0.f};
 
+// Coin histogram of an engine that runs next to the disks (e.g. the
+// lattice gas). y is the mean number of agents per coin count scaled to
+// g_diskCount agents, so it shares the chart's 0..disk count range.
+struct CompanionSeries {
+    HistoryVector xdata[9];
+    HistoryVector ydata[9];
+    double    cumulative[9] = {0.0};
+    long long samples = 0;
+};
+static CompanionSeries g_latticeSeries;
+static CompanionSeries g_graphSeries;
+
+// Keep every other point (and always the newest) and hand the slack back
+static void decimate_history(HistoryVector &v) {
+    if (v.size() < 3) return;
+    size_t out = 0;
+    for (size_t k = 0; k + 1 < v.size(); k += 2) {
+        v[out++] = v[k];
+    }
+    v[out++] = v.back();
+    v.resize(out);
+    v.shrink_to_fit();
+}
+
+// Halve the chart resolution until the tracked total fits --mem-budget.
+// The averages themselves live in cumulative counters and are unaffected.
+void enforce_memory_budget() {
+    static const size_t HISTORY_MIN_POINTS = 64;
+    static bool warned = false;
+    if (g_memBudget <= 0.0) return;
+    while (memory_total() > g_memBudget && xdata[0].size() > HISTORY_MIN_POINTS) {
+        for (int i = 0; i < 9; i++) {
+            decimate_history(xdata[i]);
+            decimate_history(ydata[i]);
+            decimate_history(g_latticeSeries.xdata[i]);
+            decimate_history(g_latticeSeries.ydata[i]);
+            decimate_history(g_graphSeries.xdata[i]);
+            decimate_history(g_graphSeries.ydata[i]);
+        }
+    }
+    if (memory_total() > g_memBudget && !warned) {
+        std::cerr << "Memory budget exceeded outside the chart history: "
+                  << format_bytes((double)memory_total()) << " tracked\n";
+        warned = true;
+    }
+}
+
 // We'll load one global font for everything
 static sf::Font g_font;
 
@@ -59,6 +1169,83 @@ struct Disk {
     int   radius;
     int   coin_count;
 };
+using DiskStore = HugeVector<Disk, MEM_DISKS>;
+
+// -------------------------------------------------------------
+// Compact disks (--compact): 16 bytes instead of 24, so a step
+// streams a third less memory and 10^8 disks fit in 1.6 GB.
+// Positions are 16.16 fixed point, velocities 1/32 px/s in int16
+// (saturating at +-1024 px/s), and the radius comes from a small
+// per-species table. Kernels unpack a disk into a Disk, run
+// unchanged, and pack it back.
+// -------------------------------------------------------------
+struct CompactDisk {
+    int32_t  x, y;        // px * COMPACT_POS_SCALE
+    int16_t  vx, vy;      // px/s * COMPACT_VEL_SCALE
+    uint16_t coin_count;
+    uint8_t  species;     // index into g_speciesRadius
+    uint8_t  unused;
+};
+static_assert(sizeof(CompactDisk) == 16, "compact disks are 16 bytes");
+using CompactStore = HugeVector<CompactDisk, MEM_DISKS>;
+
+static const float COMPACT_POS_SCALE = 65536.f;
+static const float COMPACT_VEL_SCALE = 32.f;
+static int g_speciesRadius[256];
+static int g_speciesCount = 0;
+
+// Species for a radius, registered on first use (setup only)
+inline uint8_t compact_species(int radius) {
+    for (int s = 0; s < g_speciesCount; s++) {
+        if (g_speciesRadius[s] == radius) return (uint8_t)s;
+    }
+    if (g_speciesCount == 256) return 0;
+    g_speciesRadius[g_speciesCount] = radius;
+    return (uint8_t)g_speciesCount++;
+}
+
+inline const Disk &unpack(const Disk &d) { return d; }
+
+inline Disk unpack(const CompactDisk &c) {
+    return Disk{c.x / COMPACT_POS_SCALE, c.y / COMPACT_POS_SCALE,
+                c.vx / COMPACT_VEL_SCALE, c.vy / COMPACT_VEL_SCALE,
+                g_speciesRadius[c.species], c.coin_count};
+}
+
+inline void pack(const Disk &d, Disk &out) { out = d; }
+
+// Pair geometry without a full unpack, for the broad phase
+inline void disk_offset(const Disk &a, const Disk &b, float &dx, float &dy) {
+    dx = b.x - a.x;
+    dy = b.y - a.y;
+}
+
+inline void disk_offset(const CompactDisk &a, const CompactDisk &b, float &dx, float &dy) {
+    dx = (float)(b.x - a.x) * (1.f / COMPACT_POS_SCALE);
+    dy = (float)(b.y - a.y) * (1.f / COMPACT_POS_SCALE);
+}
+
+inline int disk_radius(const Disk &d)        { return d.radius; }
+inline int disk_radius(const CompactDisk &c) { return g_speciesRadius[c.species]; }
+
+// Round to nearest without a libm call; this runs for every disk every step
+inline float compact_round(float v) {
+    return v + std::copysign(0.5f, v);   // branchless: signs are random
+}
+
+inline void pack(const Disk &d, CompactDisk &out) {
+    auto velocity = [](float v) {
+        float q = compact_round(v * COMPACT_VEL_SCALE);
+        return (int16_t)std::min(32767.f, std::max(-32767.f, q));  // negation stays in range
+    };
+    out.x  = (int32_t)compact_round(d.x * COMPACT_POS_SCALE);
+    out.y  = (int32_t)compact_round(d.y * COMPACT_POS_SCALE);
+    out.vx = velocity(d.vx);
+    out.vy = velocity(d.vy);
+    out.coin_count = (uint16_t)d.coin_count;
+    out.species    = compact_species(d.radius);
+    out.unused     = 0;
+}
 
 // Distance utility
 float distance(Disk &a, Disk &b) {
@@ -68,12 +1255,316 @@ float distance(Disk &a, Disk &b) {
 }
 
 // -------------------------------------------------------------
-// handle_disk_collision: bounce + coin exchange + overlap fix
+// exchange_coins: the coin rule shared by every engine
 // -------------------------------------------------------------
-bool handle_disk_collision(Disk &d1, Disk &d2, std::mt19937 &rng) {
-    float dist = distance(d1, d2);
-    if (dist < d1.radius + d2.radius) {
-        float nx = (d2.x - d1.x) / dist;
+void exchange_coins(int &c1, int &c2, std::mt19937 &rng) {
+    // Coin exchange (random)
+    std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+    int total_coins_d1 = c1;
+    int total_coins_d2 = c2;
+
+    // Standard coin exchange (50% chance for each coin)
+    int coins_to_d2 = 0;
+    for (int i = 0; i < total_coins_d1; i++) {
+        if (dist01(rng) < 0.5f) {
+            coins_to_d2++;
+        }
+    }
+    // Ensure we only subtract up to the number of coins available
+    coins_to_d2 = std::min(coins_to_d2, c1);
+    c1 -= coins_to_d2;
+    c2 += coins_to_d2;
+
+    int coins_to_d1 = 0;
+    for (int i = 0; i < total_coins_d2; i++) {
+        if (dist01(rng) < 0.5f) {
+            coins_to_d1++;
+        }
+    }
+    // Ensure we only subtract up to the number of coins available
+    coins_to_d1 = std::min(coins_to_d1, c2);
+    c2 -= coins_to_d1;
+    c1 += coins_to_d1;
+
+    // Clamp
+    if (c1 > MAX_COINS_PER_DISK) c1 = MAX_COINS_PER_DISK;
+    if (c2 > MAX_COINS_PER_DISK) c2 = MAX_COINS_PER_DISK;
+}
+
+// Integer form of exchange_coins for engines without an mt19937:
+// every coin moves on its own random bit, so each side still sends
+// Binomial(coins, 1/2) coins and the clamp is unchanged.
+static_assert(MAX_COINS_PER_DISK < 32, "coin bits come from one 64-bit word");
+inline void exchange_coins_bits(int &c1, int &c2, uint64_t bits) {
+    int coins_to_d2 = __builtin_popcountll(bits & ((1ull << c1) - 1));
+    c1 -= coins_to_d2;
+    c2 += coins_to_d2;
+    int coins_to_d1 = __builtin_popcountll((bits >> 32) & ((1ull << (c2 - coins_to_d2)) - 1));
+    c2 -= coins_to_d1;
+    c1 += coins_to_d1;
+    if (c1 > MAX_COINS_PER_DISK) c1 = MAX_COINS_PER_DISK;
+    if (c2 > MAX_COINS_PER_DISK) c2 = MAX_COINS_PER_DISK;
+}
+
+// Small integer generator for engines that need many random words
+inline uint64_t splitmix64(uint64_t &state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// -------------------------------------------------------------
+// Live inequality metrics over the disks' coin counts
+//
+// Two Fenwick trees indexed by coin value hold the number of disks
+// and the coins held at each value. Moving one disk from a to b
+// coins costs O(log K) and also updates the sum of |c_i - c_j| over
+// all disk pairs, from which Gini = sum / (disks * coins).
+// -------------------------------------------------------------
+struct Fenwick {
+    TrackedVector<long long, MEM_STATISTICS> tree;   // 1-based
+
+    void reset(int size) { tree.assign(size + 1, 0); }
+
+    void add(int index, long long delta) {
+        for (int i = index + 1; i < (int)tree.size(); i += i & -i) tree[i] += delta;
+    }
+
+    // Sum over values [0, end)
+    long long prefix(int end) const {
+        long long sum = 0;
+        for (int i = end; i > 0; i -= i & -i) sum += tree[i];
+        return sum;
+    }
+
+    // Smallest value v with prefix(v + 1) >= target
+    int lower_bound(long long target) const {
+        int pos = 0;
+        int step = 1;
+        while (step * 2 < (int)tree.size()) step *= 2;
+        for (; step > 0; step /= 2) {
+            if (pos + step < (int)tree.size() && tree[pos + step] < target) {
+                pos += step;
+                target -= tree[pos];
+            }
+        }
+        return pos;
+    }
+};
+
+struct CoinInequality {
+    Fenwick   disks;            // disks holding each coin value
+    Fenwick   coins;            // coins held at each coin value
+    long long n = 0;
+    long long total = 0;
+    long long pairAbsDiff = 0;  // sum over disk pairs of |c_i - c_j|
+};
+static CoinInequality g_inequality;
+
+// Sum of |v - c| over every disk currently in the trees
+static long long inequality_abs_diff(int v) {
+    const CoinInequality &q = g_inequality;
+    long long below      = q.disks.prefix(v);
+    long long belowCoins = q.coins.prefix(v);
+    long long above      = q.n - q.disks.prefix(v + 1);
+    long long aboveCoins = q.total - q.coins.prefix(v + 1);
+    return (v * below - belowCoins) + (aboveCoins - v * above);
+}
+
+static void inequality_insert(int v) {
+    g_inequality.pairAbsDiff += inequality_abs_diff(v);
+    g_inequality.disks.add(v, 1);
+    g_inequality.coins.add(v, v);
+    g_inequality.n++;
+    g_inequality.total += v;
+}
+
+static void inequality_remove(int v) {
+    g_inequality.disks.add(v, -1);
+    g_inequality.coins.add(v, -v);
+    g_inequality.n--;
+    g_inequality.total -= v;
+    g_inequality.pairAbsDiff -= inequality_abs_diff(v);
+}
+
+// One disk went from `before` to `after` coins
+inline void inequality_move(int before, int after) {
+    if (before == after || g_inequality.disks.tree.empty()) return;
+    inequality_remove(before);
+    inequality_insert(after);
+}
+
+template <class Store>
+void inequality_init(const Store &disks) {
+    g_inequality = CoinInequality();
+    g_inequality.disks.reset(MAX_COINS_PER_DISK + 1);
+    g_inequality.coins.reset(MAX_COINS_PER_DISK + 1);
+    for (auto &d : disks) inequality_insert(d.coin_count);
+}
+
+// Coin holding at quantile p (0..1): smallest v with >= p of disks at or below it
+int coin_quantile(double p) {
+    long long rank = std::max(1LL, (long long)std::ceil(p * g_inequality.n));
+    return g_inequality.disks.lower_bound(rank);
+}
+
+double coin_gini() {
+    if (g_inequality.n == 0 || g_inequality.total == 0) return 0.0;
+    return (double)g_inequality.pairAbsDiff / ((double)g_inequality.n * g_inequality.total);
+}
+
+// -------------------------------------------------------------
+// Per-disk occupancy: steps each disk has spent at each coin value
+//
+// Counters are structure-of-arrays (time[k][disk], uint32) and only
+// touched when a disk's coins change: the steps since its previous
+// change are credited to the value it is leaving. A counter that
+// would pass 2^32 keeps the low bits and spills the rest into a
+// sparse map, so the common case stays 4 bytes per cell.
+// -------------------------------------------------------------
+struct DiskOccupancy {
+    const Disk *base = nullptr;                 // disks.data(), for disk indices (not compact)
+    int disks = 0;
+    TrackedVector<uint32_t, MEM_STATISTICS>  time[9];  // time[k][disk]
+    TrackedVector<long long, MEM_STATISTICS> since;    // step of each disk's last change
+    std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                       TrackedAllocator<std::pair<const uint64_t, uint64_t>, MEM_STATISTICS>>
+        spill;                                         // (k * disks + disk) -> units of 2^32
+};
+static DiskOccupancy g_occupancy;
+
+void occupancy_init(size_t disks, const Disk *base) {
+    g_occupancy.base  = base;
+    g_occupancy.disks = (int)disks;
+    for (auto &t : g_occupancy.time) t.assign(disks, 0);
+    g_occupancy.since.assign(disks, step_count);
+    g_occupancy.spill.clear();
+}
+
+void occupancy_init(const DiskStore &disks)    { occupancy_init(disks.size(), disks.data()); }
+void occupancy_init(const CompactStore &disks) { occupancy_init(disks.size(), nullptr); }
+
+static void occupancy_credit(int k, int disk, uint64_t steps) {
+    uint32_t &cell = g_occupancy.time[k][disk];
+    uint64_t sum = (uint64_t)cell + steps;
+    if (sum >> 32) {
+        g_occupancy.spill[(uint64_t)k * g_occupancy.disks + disk] += sum >> 32;
+    }
+    cell = (uint32_t)sum;
+}
+
+static uint64_t occupancy_total(int k, int disk) {
+    uint64_t t = g_occupancy.time[k][disk];
+    if (!g_occupancy.spill.empty()) {
+        auto it = g_occupancy.spill.find((uint64_t)k * g_occupancy.disks + disk);
+        if (it != g_occupancy.spill.end()) t += it->second << 32;
+    }
+    return t;
+}
+
+inline void occupancy_move(int disk, int before, int after) {
+    if (before == after || disk < 0 || disk >= g_occupancy.disks) return;
+    occupancy_credit(before, disk, (uint64_t)(step_count - g_occupancy.since[disk]));
+    g_occupancy.since[disk] = step_count;
+}
+
+// Total-variation distance between each disk's time-averaged coin
+// distribution and the ensemble average of those distributions
+struct ErgodicityGap {
+    double mean = 0.0;
+    double max  = 0.0;
+};
+
+template <class Store>
+ErgodicityGap ergodicity_gap(const Store &disks) {
+    ErgodicityGap gap;
+    int n = g_occupancy.disks;
+    double elapsed = (double)step_count;
+    if (n == 0 || elapsed <= 0.0) return gap;
+
+    // Time averages include the open interval at each disk's current value
+    auto disk_time = [&](int i, int k) {
+        double t = (double)occupancy_total(k, i);
+        if (k == disks[i].coin_count) t += (double)(step_count - g_occupancy.since[i]);
+        return t / elapsed;
+    };
+    std::vector<std::array<double, 9>> sums(pool_size());
+    for (auto &part : sums) part.fill(0.0);
+    parallel_for((size_t)n, PARALLEL_MIN_CHUNK, [&](size_t from, size_t to, int chunk) {
+        for (size_t i = from; i < to; i++) {
+            for (int k = 0; k < 9; k++) sums[chunk][k] += disk_time((int)i, k) / n;
+        }
+    });
+    double ensemble[9] = {0.0};
+    for (auto &part : sums) {
+        for (int k = 0; k < 9; k++) ensemble[k] += part[k];
+    }
+
+    std::vector<ErgodicityGap> gaps(pool_size());
+    parallel_for((size_t)n, PARALLEL_MIN_CHUNK, [&](size_t from, size_t to, int chunk) {
+        for (size_t i = from; i < to; i++) {
+            double tv = 0.0;
+            for (int k = 0; k < 9; k++) tv += std::fabs(disk_time((int)i, k) - ensemble[k]);
+            tv *= 0.5;
+            gaps[chunk].mean += tv / n;
+            gaps[chunk].max = std::max(gaps[chunk].max, tv);
+        }
+    });
+    for (auto &part : gaps) {
+        gap.mean += part.mean;
+        gap.max = std::max(gap.max, part.max);
+    }
+    return gap;
+}
+
+// Coin changes made inside a parallel collision pass are logged here and
+// applied to the shared trackers afterwards, in a fixed order
+struct CoinMove {
+    int disk;
+    int before, after;
+};
+static thread_local std::vector<CoinMove> *t_coinMoves = nullptr;
+// Set while colliding unpacked copies of compact disks: the caller
+// knows the disk indices and records the move itself
+static thread_local bool t_coinsUntracked = false;
+
+void record_coin_move(int disk, int before, int after) {
+    if (t_coinMoves) {
+        t_coinMoves->push_back({disk, before, after});
+        return;
+    }
+    inequality_move(before, after);
+    occupancy_move(disk, before, after);
+}
+
+void apply_coin_moves(const std::vector<CoinMove> &moves) {
+    for (const CoinMove &m : moves) {
+        inequality_move(m.before, m.after);
+        occupancy_move(m.disk, m.before, m.after);
+    }
+}
+
+// Coin exchange between two disks, keeping the inequality metrics current
+inline void exchange_disk_coins(Disk &d1, Disk &d2, std::mt19937 &rng) {
+    int before1 = d1.coin_count;
+    int before2 = d2.coin_count;
+    exchange_coins(d1.coin_count, d2.coin_count, rng);
+    if (t_coinsUntracked) return;
+    const Disk *base = g_occupancy.base;
+    record_coin_move(base ? (int)(&d1 - base) : -1, before1, d1.coin_count);
+    record_coin_move(base ? (int)(&d2 - base) : -1, before2, d2.coin_count);
+}
+
+// -------------------------------------------------------------
+// handle_disk_collision: bounce + coin exchange + overlap fix
+// -------------------------------------------------------------
+bool handle_disk_collision(Disk &d1, Disk &d2, std::mt19937 &rng) {
+    float dist = distance(d1, d2);
+    // Coincident centres (a corner pile-up, or equal quantized positions)
+    // have no contact normal; leave them for the next step
+    if (dist > 0.f && dist < d1.radius + d2.radius) {
+        float nx = (d2.x - d1.x) / dist;
         float ny = (d2.y - d1.y) / dist;
 
         float v1n = d1.vx * nx + d1.vy * ny;
@@ -85,281 +1576,3731 @@ bool handle_disk_collision(Disk &d1, Disk &d2, std::mt19937 &rng) {
         d2.vx += (v1n - v2n) * nx;
         d2.vy += (v1n - v2n) * ny;
 
-        // Coin exchange (random)
-        std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
-        int total_coins_d1 = d1.coin_count;
-        int total_coins_d2 = d2.coin_count;
+        exchange_disk_coins(d1, d2, rng);
+
+        // Overlap fix
+        float overlap = (d1.radius + d2.radius) - dist;
+        if (overlap > 0.f) {
+            float half = overlap * 0.5f;
+            d1.x -= nx * half;
+            d1.y -= ny * half;
+            d2.x += nx * half;
+            d2.y += ny * half;
+        }
+
+        return true;
+    }
+    return false;
+}
+
+// ------------------------------------
+// update_position: uses g_speedFactor
+// ------------------------------------
+void update_position(Disk &disk, float dt) {
+    // Multiply velocities by dt * g_speedFactor
+    disk.x += disk.vx * dt * g_speedFactor;
+    disk.y += disk.vy * dt * g_speedFactor;
+
+    // bounce off left/right
+    if (disk.x - disk.radius < 0) {
+        disk.x = disk.radius;
+        disk.vx = -disk.vx;
+    } else if (disk.x + disk.radius > WIDTH) {
+        disk.x = WIDTH - disk.radius;
+        disk.vx = -disk.vx;
+    }
+
+    // bounce off top/bottom (we treat CHART_TOP as bottom)
+    if (disk.y - disk.radius < 0) {
+        disk.y = disk.radius;
+        disk.vy = -disk.vy;
+    } else if (disk.y + disk.radius > CHART_TOP) {
+        disk.y = CHART_TOP - disk.radius;
+        disk.vy = -disk.vy;
+    }
+}
+
+// Same walls in fixed point for compact disks; no float round trip,
+// which would drop the low position bits far from the origin
+void update_position(CompactDisk &disk, float dt) {
+    const float step = dt * g_speedFactor * (COMPACT_POS_SCALE / COMPACT_VEL_SCALE);
+    const int32_t unit   = (int32_t)COMPACT_POS_SCALE;
+    const int32_t r      = g_speciesRadius[disk.species] * unit;
+    const int32_t right  = WIDTH * unit;
+    const int32_t bottom = (int32_t)CHART_TOP * unit;
+    disk.x += (int32_t)compact_round(disk.vx * step);
+    disk.y += (int32_t)compact_round(disk.vy * step);
+
+    if (disk.x - r < 0) {
+        disk.x = r;
+        disk.vx = -disk.vx;
+    } else if (disk.x + r > right) {
+        disk.x = right - r;
+        disk.vx = -disk.vx;
+    }
+    if (disk.y - r < 0) {
+        disk.y = r;
+        disk.vy = -disk.vy;
+    } else if (disk.y + r > bottom) {
+        disk.y = bottom - r;
+        disk.vy = -disk.vy;
+    }
+}
+
+// -------------------------------------------------------------
+// CellGrid: uniform square cells over the disk area. Disks are
+// counting-sorted by cell so each cell's members are contiguous.
+// Shared by the broad phase and the DSMC engine.
+// -------------------------------------------------------------
+struct CellGrid {
+    int   cols = 0, rows = 0;
+    float size = 0.f;
+    HugeVector<int, MEM_BROAD_PHASE> start;    // cols*rows+1 offsets into members
+    HugeVector<int, MEM_BROAD_PHASE> members;  // disk indices sorted by cell
+    HugeVector<int, MEM_BROAD_PHASE> fill;     // scratch for the sort
+};
+
+void cell_grid_init(CellGrid &g, float size, size_t disks) {
+    g.size = size;
+    g.cols = std::max(1, (int)std::ceil(WIDTH / size));
+    g.rows = std::max(1, (int)std::ceil(CHART_TOP / size));
+    g.start.clear();
+    g.start.resize((size_t)g.cols * g.rows + 1);
+    first_touch(g.start);
+    g.fill.clear();
+    g.fill.resize((size_t)g.cols * g.rows);
+    first_touch(g.fill);
+    g.members.clear();
+    g.members.resize(disks);
+    first_touch(g.members);
+}
+
+inline int cell_grid_cell(const CellGrid &g, float x, float y) {
+    int cx = std::min(g.cols - 1, std::max(0, (int)(x / g.size)));
+    int cy = std::min(g.rows - 1, std::max(0, (int)(y / g.size)));
+    return cy * g.cols + cx;
+}
+
+inline int cell_grid_cell(const CellGrid &g, const Disk &d) {
+    return cell_grid_cell(g, d.x, d.y);
+}
+
+inline int cell_grid_cell(const CellGrid &g, const CompactDisk &c) {
+    return cell_grid_cell(g, c.x * (1.f / COMPACT_POS_SCALE), c.y * (1.f / COMPACT_POS_SCALE));
+}
+
+template <class Store>
+void cell_grid_build(CellGrid &g, const Store &disks) {
+    int cells = g.cols * g.rows;
+    std::fill(g.start.begin(), g.start.end(), 0);
+    if (g.members.size() < disks.size()) g.members.resize(disks.size());
+    for (auto &d : disks) {
+        g.start[cell_grid_cell(g, d) + 1]++;
+    }
+    for (int c = 0; c < cells; c++) {
+        g.start[c + 1] += g.start[c];
+    }
+    g.fill.assign(g.start.begin(), g.start.end() - 1);
+    for (int i = 0; i < (int)disks.size(); i++) {
+        g.members[g.fill[cell_grid_cell(g, disks[i])]++] = i;
+    }
+}
+
+// -------------------------------------------------------------
+// Radial distribution function g(r), binned from the pairs the
+// broad phase visits anyway. Each worker adds to its own uint32
+// bins; rdf_reduce folds them into the totals once per sample.
+// -------------------------------------------------------------
+static const int RDF_BINS = 64;
+
+struct RadialDistribution {
+    float range = 0.f;
+    std::vector<TrackedVector<uint32_t, MEM_BROAD_PHASE>> workerBins;
+    double    totals[RDF_BINS] = {0.0};
+    long long passes = 0;        // collision passes accumulated
+    int       disks  = 0;
+};
+static RadialDistribution g_rdf;
+
+void rdf_init(float range, int disks, int workers) {
+    g_rdf = RadialDistribution();
+    g_rdf.range = range;
+    g_rdf.disks = disks;
+    g_rdf.workerBins.assign(workers, TrackedVector<uint32_t, MEM_BROAD_PHASE>(RDF_BINS, 0));
+}
+
+void rdf_reduce() {
+    for (auto &bins : g_rdf.workerBins) {
+        for (int b = 0; b < RDF_BINS; b++) {
+            g_rdf.totals[b] += bins[b];
+            bins[b] = 0;
+        }
+    }
+}
+
+// g(r) at bin b: observed pairs over the ideal-gas expectation
+// N(N-1)/2 * shell_area / area, where area is what disk centres can reach
+double rdf_value(int b) {
+    if (g_rdf.passes == 0 || g_rdf.disks < 2) return 0.0;
+    double dr    = g_rdf.range / RDF_BINS;
+    double r0    = b * dr, r1 = r0 + dr;
+    double shell = 3.14159265358979 * (r1*r1 - r0*r0);
+    double area  = (WIDTH - 2.0 * g_diskRadius) * (CHART_TOP - 2.0 * g_diskRadius);
+    double ideal = 0.5 * g_rdf.disks * (g_rdf.disks - 1) * shell / area;
+    return g_rdf.totals[b] / (g_rdf.passes * ideal);
+}
+
+bool export_rdf(const std::string &path) {
+    rdf_reduce();
+    AsyncOfstream out(path);
+    if (!out) return false;
+    out << "# disk_sim radial distribution\n"
+        << "# disks=" << g_rdf.disks << " passes=" << g_rdf.passes
+        << " range=" << g_rdf.range << "\n"
+        << "r,g\n";
+    double dr = g_rdf.range / RDF_BINS;
+    for (int b = 0; b < RDF_BINS; b++) {
+        out << (b + 0.5) * dr << "," << rdf_value(b) << "\n";
+    }
+    return out.close();
+}
+
+// -------------------------------------------------------------
+// collide_disks_all_pairs: reference pass, every pair tested
+// -------------------------------------------------------------
+long long collide_disks_all_pairs(DiskStore &disks, std::mt19937 &rng) {
+    long long collisions = 0;
+    int n = (int)disks.size();
+    for (int i = 0; i < n; i++) {
+        for (int j = i+1; j < n; j++) {
+            if (handle_disk_collision(disks[i], disks[j], rng)) {
+                collisions++;
+            }
+        }
+    }
+    return collisions;
+}
+
+// -------------------------------------------------------------
+// collide_disks: geometric pass over the broad-phase grid
+//
+// Cells are at least the g(r) range (and a disk diameter) wide, so
+// every pair closer than that lies in the same or an adjacent cell.
+// Each cell is paired with itself and its E, SW, S and SE
+// neighbours, so every pair is visited once.
+//
+// Row y's pairs only touch disks in rows y and y + 1, so all even
+// rows run in parallel, then all odd rows. Each row draws coins from
+// its own rng seeded from the pass, and coin-tracker updates are
+// replayed in row order, so the result does not depend on the
+// thread count.
+//
+// collide_pair resolves one contact in place; compact disks are
+// unpacked, collided and packed back. Tiled runs pass one band of
+// rows at a time ([rowBegin, rowEnd), which needs row rowEnd too).
+// -------------------------------------------------------------
+static CellGrid g_broadPhase;
+static std::vector<std::vector<CoinMove>> g_rowMoves;  // per row, reused
+
+void broad_phase_init(size_t disks) {
+    float range = g_rdfRange > 0.f ? g_rdfRange : 4.f * g_diskRadius;
+    float cell  = std::max(g_cellSize > 0.f ? g_cellSize : range, 2.f * g_diskRadius);
+    cell_grid_init(g_broadPhase, cell, disks);
+    rdf_init(std::min(range, cell), (int)disks, pool_size());   // pairs beyond a cell are not visited
+    g_rowMoves.assign(g_broadPhase.rows, std::vector<CoinMove>());
+}
+
+inline bool collide_pair(DiskStore &disks, int i, int j, std::mt19937 &rng) {
+    return handle_disk_collision(disks[i], disks[j], rng);
+}
+
+inline bool collide_pair(CompactStore &disks, int i, int j, std::mt19937 &rng) {
+    Disk a = unpack(disks[i]);
+    Disk b = unpack(disks[j]);
+    int beforeA = a.coin_count, beforeB = b.coin_count;
+    t_coinsUntracked = true;
+    bool hit = handle_disk_collision(a, b, rng);
+    t_coinsUntracked = false;
+    if (!hit) return false;
+    record_coin_move(i, beforeA, a.coin_count);
+    record_coin_move(j, beforeB, b.coin_count);
+    pack(a, disks[i]);
+    pack(b, disks[j]);
+    return true;
+}
+
+template <class Store>
+long long collide_disks(Store &disks, std::mt19937 &rng, int rowBegin = 0, int rowEnd = -1) {
+    CellGrid &g = g_broadPhase;
+    if (rowEnd < 0) rowEnd = g.rows;
+    cell_grid_build(g, disks);
+    float range2   = g_rdf.range * g_rdf.range;
+    float binScale = RDF_BINS / g_rdf.range;
+    uint64_t passSeed = ((uint64_t)rng() << 32) | rng();
+
+    auto collide_row = [&](int cy, uint32_t *bins) {
+        uint64_t state = passSeed + (uint64_t)cy;
+        std::mt19937 rowRng((uint32_t)splitmix64(state));
+        int collisions = 0;
+
+        auto visit = [&](int i, int j) {
+            float dx, dy;
+            disk_offset(disks[i], disks[j], dx, dy);
+            float r2 = dx*dx + dy*dy;
+            if (!(r2 < range2)) return;   // also skips NaN positions
+            bins[std::min(RDF_BINS - 1, (int)(std::sqrt(r2) * binScale))]++;
+            float contact = (float)(disk_radius(disks[i]) + disk_radius(disks[j]));
+            if (r2 < contact * contact && collide_pair(disks, i, j, rowRng)) {
+                collisions++;
+            }
+        };
+
+        const int stencil[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+        for (int cx = 0; cx < g.cols; cx++) {
+            int c = cy * g.cols + cx;
+            for (int p = g.start[c]; p < g.start[c + 1]; p++) {
+                for (int q = p + 1; q < g.start[c + 1]; q++) {
+                    visit(g.members[p], g.members[q]);
+                }
+            }
+            for (auto &o : stencil) {
+                int nx = cx + o[0], ny = cy + o[1];
+                if (nx < 0 || nx >= g.cols || ny >= g.rows) continue;
+                int n = ny * g.cols + nx;
+                for (int p = g.start[c]; p < g.start[c + 1]; p++) {
+                    for (int q = g.start[n]; q < g.start[n + 1]; q++) {
+                        visit(g.members[p], g.members[q]);
+                    }
+                }
+            }
+        }
+        return collisions;
+    };
+
+    long long collisions = 0;
+    for (int parity = 0; parity < 2; parity++) {
+        size_t rows = (size_t)std::max(0, rowEnd - rowBegin - parity + 1) / 2;
+        size_t minRows = disks.size() < PARALLEL_MIN_CHUNK ? rows : 1;
+        std::vector<int> rowCollisions(rows, 0);
+        parallel_for(rows, minRows, [&](size_t from, size_t to, int chunk) {
+            for (size_t k = from; k < to; k++) {
+                int cy = rowBegin + parity + 2 * (int)k;
+                g_rowMoves[cy].clear();
+                t_coinMoves = &g_rowMoves[cy];
+                rowCollisions[k] = collide_row(cy, g_rdf.workerBins[chunk].data());
+                t_coinMoves = nullptr;
+            }
+        });
+        for (size_t k = 0; k < rows; k++) {
+            collisions += rowCollisions[k];
+            apply_coin_moves(g_rowMoves[rowBegin + parity + 2 * k]);
+        }
+    }
+    if (rowBegin == 0) g_rdf.passes++;   // a banded pass counts once
+    return collisions;
+}
+
+// -------------------------------------------------------------
+// DSMC engine (Bird's no-time-counter scheme, 2D hard disks)
+//
+// Disks are binned into square cells. Each step a cell holding
+// n disks draws
+//     0.5 * n * (n-1) * (sigma*cr)_max * dt / cell_area
+// candidate pairs, where cell_area is the part of the cell that disk
+// centres can reach (walls sit a radius in, and the last row and
+// column may be cut off by the box) (fraction carried over), and a candidate is
+// accepted with probability (sigma*cr) / (sigma*cr)_max, where
+// sigma is the 2D cross-section and cr the relative speed. Disks
+// touch at one diameter d, so a centre passing anywhere in a strip
+// 2d wide hits: sigma = 2d (4 radii), not d.
+// Accepted pairs scatter like hard disks with a uniform impact
+// parameter and then go through exchange_coins.
+// -------------------------------------------------------------
+struct DsmcCells {
+    CellGrid           grid;
+    TrackedVector<float, MEM_BROAD_PHASE> sigmaCrMax;  // per cell, only ever grows
+    TrackedVector<float, MEM_BROAD_PHASE> remainder;   // fractional candidates carried over
+    TrackedVector<float, MEM_BROAD_PHASE> area;        // per cell, reachable by disk centres
+};
+static DsmcCells g_dsmc;
+
+void dsmc_init(const DiskStore &disks) {
+    cell_grid_init(g_dsmc.grid, g_dsmcCell > 0.f ? g_dsmcCell : 4.f * g_diskRadius, disks.size());
+    int cells = g_dsmc.grid.cols * g_dsmc.grid.rows;
+
+    // Start from twice the fastest disk; cells raise it as needed
+    float vmax = 0.f;
+    for (auto &d : disks) {
+        vmax = std::max(vmax, std::sqrt(d.vx*d.vx + d.vy*d.vy));
+    }
+    g_dsmc.sigmaCrMax.assign(cells, 4.f * g_diskRadius * 2.f * vmax);
+    g_dsmc.remainder.assign(cells, 0.f);
+
+    // Centres stay in [r, WIDTH - r] x [r, CHART_TOP - r]
+    const CellGrid &g = g_dsmc.grid;
+    auto reach = [&](int i, float limit) {
+        float lo = std::max(i * g.size, (float)g_diskRadius);
+        float hi = std::min((i + 1) * g.size, limit - g_diskRadius);
+        return std::max(0.f, hi - lo);
+    };
+    g_dsmc.area.assign(cells, 0.f);
+    for (int cy = 0; cy < g.rows; cy++) {
+        for (int cx = 0; cx < g.cols; cx++) {
+            g_dsmc.area[cy * g.cols + cx] = reach(cx, (float)WIDTH) * reach(cy, CHART_TOP);
+        }
+    }
+}
+
+long long dsmc_collide(DiskStore &disks, float dt, std::mt19937 &rng) {
+    CellGrid &grid = g_dsmc.grid;
+    int cells = grid.cols * grid.rows;
+    cell_grid_build(grid, disks);
+
+    std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+    float contact = 2.f * g_diskRadius;   // centre distance at contact
+    float sigma   = 2.f * contact;        // cross-section
+    float step  = dt * g_speedFactor;  // velocities are scaled in update_position too
+    long long collisions = 0;
+
+    for (int c = 0; c < cells; c++) {
+        int first = grid.start[c];
+        int n     = grid.start[c + 1] - first;
+        if (n < 2 || g_dsmc.area[c] <= 0.f) continue;
+
+        float expected = 0.5f * n * (n - 1) * g_dsmc.sigmaCrMax[c] * step / g_dsmc.area[c]
+                       + g_dsmc.remainder[c];
+        int candidates = (int)expected;
+        g_dsmc.remainder[c] = expected - candidates;
+
+        // Uniform over distinct pairs: b from the n-1 disks other than a
+        std::uniform_int_distribution<int> pick(0, n - 1), pickOther(0, n - 2);
+        for (int k = 0; k < candidates; k++) {
+            int a = pick(rng);
+            int b = pickOther(rng);
+            if (b >= a) b++;
+            Disk &d1 = disks[grid.members[first + a]];
+            Disk &d2 = disks[grid.members[first + b]];
+
+            float rvx = d2.vx - d1.vx;
+            float rvy = d2.vy - d1.vy;
+            float cr  = std::sqrt(rvx*rvx + rvy*rvy);
+            float sigmaCr = sigma * cr;
+            if (sigmaCr > g_dsmc.sigmaCrMax[c]) {
+                g_dsmc.sigmaCrMax[c] = sigmaCr;
+            }
+            if (cr <= 0.f || dist01(rng) * g_dsmc.sigmaCrMax[c] >= sigmaCr) {
+                continue;
+            }
+
+            // Contact normal for a uniform impact parameter b in [-contact, contact]:
+            // sin(theta) = b / contact, measured from the approach direction
+            float s  = 2.f * dist01(rng) - 1.f;
+            float co = std::sqrt(1.f - s*s);
+            float ux = -rvx / cr, uy = -rvy / cr;  // direction d1 approaches d2
+            float nx = co * ux - s * uy;
+            float ny = co * uy + s * ux;
+
+            float v1n = d1.vx * nx + d1.vy * ny;
+            float v2n = d2.vx * nx + d2.vy * ny;
+            d1.vx += (v2n - v1n) * nx;
+            d1.vy += (v2n - v1n) * ny;
+            d2.vx += (v1n - v2n) * nx;
+            d2.vy += (v1n - v2n) * ny;
+
+            exchange_disk_coins(d1, d2, rng);
+            collisions++;
+        }
+    }
+    return collisions;
+}
+
+// -------------------------------------------------------------
+// Disk setup and one physics step for the selected engine
+// -------------------------------------------------------------
+
+// Deal coins from disk 0 up, at most MAX_COINS_PER_DISK each
+// (the default 6 disks / 8 coins gives {8, 0, 0, 0, 0, 0})
+std::vector<int> deal_coins(int disks, int coins) {
+    std::vector<int> distribution(disks, 0);
+    for (int i = 0, left = coins; left > 0; i++) {
+        distribution[i] = std::min(left, MAX_COINS_PER_DISK);
+        left -= distribution[i];
+    }
+    return distribution;
+}
+
+// One new disk at a random position with a random velocity
+Disk make_disk(int coins, std::mt19937 &rng) {
+    std::uniform_real_distribution<float> velDist(-200.f, 200.f);
+    float x  = (float)(g_diskRadius + rand() % (int(CHART_TOP) - 2*g_diskRadius));
+    float y  = (float)(g_diskRadius + rand() % (int(CHART_TOP) - 2*g_diskRadius));
+    float vx = velDist(rng);
+    float vy = velDist(rng);
+    // no initial speedFactor here, we apply g_speedFactor only in update_position
+    return Disk{x, y, vx, vy, g_diskRadius, coins};
+}
+
+template <class Store = DiskStore>
+Store place_disks(const std::vector<int> &distribution, std::mt19937 &rng) {
+    Store disks(distribution.size());
+    first_touch(disks);
+    for (size_t i = 0; i < disks.size(); i++) {
+        pack(make_disk(distribution[i], rng), disks[i]);
+    }
+    return disks;
+}
+
+void engine_init(const DiskStore &disks, Engine engine = g_engine) {
+    if (engine == Engine::DSMC) {
+        dsmc_init(disks);
+    } else {
+        broad_phase_init(disks.size());
+    }
+}
+
+// Move every disk, then collide; returns the collisions this step
+long long physics_step(DiskStore &disks, float dt, std::mt19937 &rng,
+                       Engine engine = g_engine) {
+    TraceScope trace("physics");
+    parallel_for(disks.size(), PARALLEL_MIN_CHUNK, [&](size_t from, size_t to, int) {
+        for (size_t i = from; i < to; i++) update_position(disks[i], dt);
+    });
+    switch (engine) {
+    case Engine::Reference: return collide_disks_all_pairs(disks, rng);
+    case Engine::DSMC:      return dsmc_collide(disks, dt, rng);
+    default:                return collide_disks(disks, rng);
+    }
+}
+
+void engine_init(const CompactStore &disks) {
+    broad_phase_init(disks.size());
+}
+
+// Compact disks: geometric engine only (parse_args enforces it)
+long long physics_step(CompactStore &disks, float dt, std::mt19937 &rng) {
+    TraceScope trace("physics");
+    parallel_for(disks.size(), PARALLEL_MIN_CHUNK, [&](size_t from, size_t to, int) {
+        for (size_t i = from; i < to; i++) update_position(disks[i], dt);
+    });
+    return collide_disks(disks, rng);
+}
+
+// -------------------------------------------------------------
+// Lattice-gas engine
+//
+// Agents sit on a periodic grid: one occupancy bit per cell plus a
+// coin byte per cell (0 when empty). A step picks a random axis and
+// parity and pairs every cell with its neighbour along that axis.
+// Pairs are disjoint, so 64 cells update at once with integer bit
+// operations: in a pair with one agent it hops across on a random
+// bit, and two agents meet on a random bit and exchange coins.
+// -------------------------------------------------------------
+struct LatticeGas {
+    int width  = 0;                 // cells per row, multiple of 64
+    int height = 0;                 // rows, even
+    int words  = 0;                 // occupancy words per row
+    TrackedVector<uint64_t, MEM_COMPANIONS> occupied;
+    TrackedVector<uint8_t, MEM_COMPANIONS>  coins;
+    uint64_t  rng       = 0x2545F4914F6CDD1Dull;
+    long long agents    = 0;
+    long long exchanges = 0;
+    long long counts[9] = {0};      // agents holding 0..8 coins
+};
+static LatticeGas g_lattice;
+
+void lattice_init(LatticeGas &g, long long agents, float density, long long coins) {
+    long long cells = (long long)std::ceil(agents / density);
+    int side = (int)std::ceil(std::sqrt((double)cells));
+    g.width  = std::max(64, (side + 63) / 64 * 64);
+    g.height = (int)((cells + g.width - 1) / g.width);
+    g.height += g.height & 1;
+    if (g.height < 2) g.height = 2;
+    g.words  = g.width / 64;
+    g.occupied.assign((size_t)g.words * g.height, 0);
+    g.coins.assign((size_t)g.width * g.height, 0);
+    g.agents = agents;
+
+    // Random distinct cells; coins dealt MAX_COINS_PER_DISK at a time
+    for (long long placed = 0; placed < agents; ) {
+        uint64_t cell = splitmix64(g.rng) % ((uint64_t)g.width * g.height);
+        uint64_t &word = g.occupied[cell / 64];
+        uint64_t bit   = 1ull << (cell % 64);
+        if (word & bit) continue;
+        word |= bit;
+        int c = (int)std::min<long long>(coins, MAX_COINS_PER_DISK);
+        coins -= c;
+        g.coins[cell] = (uint8_t)c;
+        g.counts[c]++;
+        placed++;
+    }
+}
+
+// Apply the hops and meetings chosen for one word of pairs.
+// Bit i of hop/meet refers to the pair (a + i, partner(a + i)).
+template <typename Partner>
+static void lattice_apply(LatticeGas &g, uint64_t hop, uint64_t meet,
+                          size_t a, Partner partner) {
+    while (hop) {
+        int i = __builtin_ctzll(hop);
+        hop &= hop - 1;
+        std::swap(g.coins[a + i], g.coins[partner(a + i)]);
+    }
+    while (meet) {
+        int i = __builtin_ctzll(meet);
+        meet &= meet - 1;
+        uint8_t &ca = g.coins[a + i];
+        uint8_t &cb = g.coins[partner(a + i)];
+        int c1 = ca, c2 = cb;
+        g.counts[c1]--;
+        g.counts[c2]--;
+        exchange_coins_bits(c1, c2, splitmix64(g.rng));
+        g.counts[c1]++;
+        g.counts[c2]++;
+        ca = (uint8_t)c1;
+        cb = (uint8_t)c2;
+        g.exchanges++;
+    }
+}
+
+void lattice_step(LatticeGas &g) {
+    TraceScope trace("lattice");
+    const uint64_t EVEN = 0x5555555555555555ull;
+    const uint64_t ODD  = ~EVEN;
+    uint64_t choice = splitmix64(g.rng);
+    int parity = (int)((choice >> 1) & 1);
+
+    if (choice & 1) {
+        // Pairs (x, x+1) along rows with x % 2 == parity, wrapping at the edge
+        uint64_t mask = parity ? ODD : EVEN;
+        for (int y = 0; y < g.height; y++) {
+            uint64_t *row  = &g.occupied[(size_t)y * g.words];
+            size_t rowBase = (size_t)y * g.width;
+            auto partner = [&](size_t c) {
+                size_t x = c - rowBase + 1;
+                return rowBase + (x == (size_t)g.width ? 0 : x);
+            };
+            for (int w = 0; w < g.words; w++) {
+                uint64_t occ  = row[w];
+                uint64_t next = row[w + 1 == g.words ? 0 : w + 1];
+                uint64_t b    = (occ >> 1) | (parity ? next << 63 : 0);
+                uint64_t rnd  = splitmix64(g.rng);
+                uint64_t hop  = (occ ^ b) & rnd & mask;
+                uint64_t meet = occ & b & rnd & mask;
+                row[w] ^= hop | (hop << 1);
+                if (hop >> 63) row[w + 1 == g.words ? 0 : w + 1] ^= 1;
+                lattice_apply(g, hop, meet, rowBase + 64 * (size_t)w, partner);
+            }
+        }
+    } else {
+        // Pairs (y, y+1) down columns with y % 2 == parity, wrapping at the edge
+        for (int y = parity; y < g.height; y += 2) {
+            int y2 = (y + 1) % g.height;
+            uint64_t *rowA = &g.occupied[(size_t)y * g.words];
+            uint64_t *rowB = &g.occupied[(size_t)y2 * g.words];
+            size_t offset  = ((size_t)y2 - y) * g.width;  // wraps for the last row
+            auto partner = [&](size_t c) { return c + offset; };
+            for (int w = 0; w < g.words; w++) {
+                uint64_t rnd  = splitmix64(g.rng);
+                uint64_t hop  = (rowA[w] ^ rowB[w]) & rnd;
+                uint64_t meet = rowA[w] & rowB[w] & rnd;
+                rowA[w] ^= hop;
+                rowB[w] ^= hop;
+                lattice_apply(g, hop, meet, (size_t)y * g.width + 64 * (size_t)w, partner);
+            }
+        }
+    }
+}
+
+// -------------------------------------------------------------
+// Graph engine: agents are the nodes of a graph in CSR form and
+// coins move along edges drawn uniformly at random.
+//
+// A step samples a batch of directed edge slots, sorts them so
+// the CSR arrays are walked front to back, and splits the batch
+// into rounds in which no node appears twice. Each round runs in
+// parallel chunks, one mt19937 per worker, through exchange_coins.
+// -------------------------------------------------------------
+struct GraphExchange {
+    uint32_t nodes = 0;
+    TrackedVector<uint64_t, MEM_COMPANIONS> rowPtr;  // nodes + 1 offsets into colIdx
+    TrackedVector<uint32_t, MEM_COMPANIONS> colIdx;  // neighbours, every edge stored both ways
+    TrackedVector<uint8_t, MEM_COMPANIONS>  coins;
+    TrackedVector<uint32_t, MEM_COMPANIONS> stamp;   // last round that touched each node
+    uint32_t  round = 0;
+    std::vector<std::mt19937> rngs;     // one per parallel_for chunk
+    uint64_t  sampler = 0x853C49E6748FEA9Bull;
+    long long exchanges = 0;
+    long long counts[9] = {0};
+};
+static GraphExchange g_graph;
+
+// Calls fn(u, v) for each "u v" line of an edge list; '#' starts a
+// comment. Node ids are decimal and below 2^32 - 1 (the node count must
+// fit in 32 bits); any other line stops the read with its line number.
+template <typename Fn>
+static bool for_each_edge(const std::string &path, Fn fn) {
+    FILE *f = std::fopen(path.c_str(), "rb");
+    if (!f) return false;
+    std::vector<char> buf(1 << 20);
+    std::string carry;
+    size_t got;
+    long long line = 0;
+    auto blank = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    // One id from [p, end); never reads past end
+    auto parse_id = [&](const char *&p, const char *end, uint32_t &id) {
+        uint64_t v = 0;
+        const char *start = p;
+        while (p < end && *p >= '0' && *p <= '9') {
+            v = v * 10 + (uint64_t)(*p++ - '0');
+            if (v >= UINT32_MAX) return false;
+        }
+        id = (uint32_t)v;
+        return p > start;
+    };
+    auto parse_line = [&](const char *p, const char *end) {
+        line++;
+        while (p < end && blank(*p)) p++;
+        if (p == end || *p == '#') return true;
+        uint32_t u, v;
+        if (!parse_id(p, end, u) || p == end || !blank(*p)) return false;
+        while (p < end && blank(*p)) p++;
+        if (!parse_id(p, end, v)) return false;
+        while (p < end && blank(*p)) p++;
+        if (p != end && *p != '#') return false;
+        fn(u, v);
+        return true;
+    };
+    bool ok = true;
+    while (ok && (got = std::fread(buf.data(), 1, buf.size(), f)) > 0) {
+        const char *p = buf.data(), *end = p + got;
+        while (ok && p < end) {
+            const char *nl = static_cast<const char *>(std::memchr(p, '\n', end - p));
+            if (!nl) { carry.append(p, end); break; }
+            if (!carry.empty()) {
+                carry.append(p, nl);
+                ok = parse_line(carry.data(), carry.data() + carry.size());
+                carry.clear();
+            } else {
+                ok = parse_line(p, nl);
+            }
+            p = nl + 1;
+        }
+    }
+    if (ok && !carry.empty()) ok = parse_line(carry.data(), carry.data() + carry.size());
+    std::fclose(f);
+    if (!ok) {
+        std::cerr << path << ":" << line << ": expected two node ids below " << UINT32_MAX << "\n";
+    }
+    return ok;
+}
+
+// Two passes over the file (degrees, then neighbours) so no edge copy is kept
+bool graph_load(GraphExchange &g, const std::string &path, std::mt19937 &seeder) {
+    std::vector<uint64_t> degree;
+    bool ok = for_each_edge(path, [&](uint32_t u, uint32_t v) {
+        if (u == v) return;
+        uint32_t top = std::max(u, v);
+        if (top >= degree.size()) degree.resize((size_t)top + 1, 0);
+        degree[u]++;
+        degree[v]++;
+    });
+    if (!ok || degree.empty()) return false;
+
+    g.nodes = (uint32_t)degree.size();
+    g.rowPtr.assign((size_t)g.nodes + 1, 0);
+    for (uint32_t u = 0; u < g.nodes; u++) {
+        g.rowPtr[u + 1] = g.rowPtr[u] + degree[u];
+    }
+    if (g.rowPtr[g.nodes] == 0) return false;
+    g.colIdx.resize(g.rowPtr[g.nodes]);
+    std::vector<uint64_t> fill(g.rowPtr.begin(), g.rowPtr.end() - 1);
+    degree.clear();
+    degree.shrink_to_fit();
+    // The file may change between passes: never write past a row, and
+    // fail unless every row ends up exactly full
+    bool fits = true;
+    ok = for_each_edge(path, [&](uint32_t u, uint32_t v) {
+        if (u == v || !fits) return;
+        if (std::max(u, v) >= g.nodes || fill[u] >= g.rowPtr[u + 1] || fill[v] >= g.rowPtr[v + 1]) {
+            fits = false;
+            return;
+        }
+        g.colIdx[fill[u]++] = v;
+        g.colIdx[fill[v]++] = u;
+    });
+    for (uint32_t u = 0; fits && u < g.nodes; u++) {
+        fits = fill[u] == g.rowPtr[u + 1];
+    }
+    if (!ok || !fits) {
+        if (ok) std::cerr << path << ": edge list changed while loading\n";
+        g.rowPtr.clear();
+        g.colIdx.clear();
+        g.nodes = 0;
+        return false;
+    }
+
+    g.coins.assign(g.nodes, 0);
+    g.stamp.assign(g.nodes, 0);
+    for (int t = 0; t < pool_size(); t++) {
+        g.rngs.emplace_back(seeder());
+    }
+    return true;
+}
+
+void graph_deal_coins(GraphExchange &g, long long coins) {
+    for (uint32_t u = 0; u < g.nodes; u++) {
+        int c = (int)std::min<long long>(coins, MAX_COINS_PER_DISK);
+        coins -= c;
+        g.coins[u] = (uint8_t)c;
+        g.counts[c]++;
+    }
+}
+
+// Exchange along a list of node-disjoint edges, in parallel when it pays off
+static void graph_exchange_round(GraphExchange &g,
+                                 const std::vector<std::pair<uint32_t, uint32_t>> &pairs) {
+    auto work = [&](size_t from, size_t to, std::mt19937 &rng, long long *delta) {
+        TraceScope trace("graph exchange");
+        for (size_t k = from; k < to; k++) {
+            uint8_t &cu = g.coins[pairs[k].first];
+            uint8_t &cv = g.coins[pairs[k].second];
+            int c1 = cu, c2 = cv;
+            delta[c1]--;
+            delta[c2]--;
+            exchange_coins(c1, c2, rng);
+            delta[c1]++;
+            delta[c2]++;
+            cu = (uint8_t)c1;
+            cv = (uint8_t)c2;
+        }
+    };
+
+    if (g.rngs.size() < 2 || pairs.size() < 65536) {
+        work(0, pairs.size(), g.rngs[0], g.counts);
+    } else {
+        std::vector<std::array<long long, 9>> deltas(g.rngs.size());
+        for (auto &d : deltas) d.fill(0);
+        parallel_for(pairs.size(), 65536 / g.rngs.size(), [&](size_t from, size_t to, int chunk) {
+            work(from, to, g.rngs[chunk], deltas[chunk].data());
+        });
+        for (auto &d : deltas) {
+            for (int i = 0; i < 9; i++) g.counts[i] += d[i];
+        }
+    }
+    g.exchanges += (long long)pairs.size();
+}
+
+void graph_step(GraphExchange &g, int batch) {
+    TraceScope trace("graph");
+    uint64_t slots = g.rowPtr[g.nodes];
+    std::vector<uint64_t> sample(batch);
+    for (auto &e : sample) {
+        e = splitmix64(g.sampler) % slots;
+    }
+    std::sort(sample.begin(), sample.end());
+
+    // Walk the sorted slots to recover each edge's source node
+    std::vector<std::pair<uint32_t, uint32_t>> pending, deferred, ready;
+    pending.reserve(sample.size());
+    uint32_t u = 0;
+    for (uint64_t e : sample) {
+        if (g.rowPtr[u + 1] <= e) {
+            u = (uint32_t)(std::upper_bound(g.rowPtr.begin() + u + 1, g.rowPtr.end(), e)
+                           - g.rowPtr.begin() - 1);
+        }
+        pending.emplace_back(u, g.colIdx[e]);
+    }
+
+    // Peel node-disjoint rounds; every sampled edge exchanges exactly once
+    while (!pending.empty()) {
+        if (++g.round == 0) {
+            std::fill(g.stamp.begin(), g.stamp.end(), 0);
+            g.round = 1;
+        }
+        ready.clear();
+        deferred.clear();
+        for (auto &p : pending) {
+            if (g.stamp[p.first] == g.round || g.stamp[p.second] == g.round) {
+                deferred.push_back(p);
+            } else {
+                g.stamp[p.first] = g.stamp[p.second] = g.round;
+                ready.push_back(p);
+            }
+        }
+        graph_exchange_round(g, ready);
+        pending.swap(deferred);
+    }
+}
+
+// Record one sample of a companion engine's coin histogram
+void update_companion(CompanionSeries &series, const long long counts[9],
+                      long long agents, long long x) {
+    series.samples++;
+    for (int i = 0; i < 9; i++) {
+        series.cumulative[i] += (double)counts[i] / agents * g_diskCount;
+        series.xdata[i].push_back(static_cast<float>(x));
+        series.ydata[i].push_back(static_cast<float>(series.cumulative[i] / series.samples));
+    }
+}
+
+// -------------------------------------------------------------
+// Velocity statistics (unit mass): streaming histograms of speed
+// and kinetic energy, filled in update_plot's pass over the disks.
+//
+// In 2D equilibrium the speed follows f(v) = v/kT exp(-v^2 / 2kT)
+// and the energy P(E) = exp(-E/kT) / kT. kT is estimated from
+// equipartition (<E> = kT) and from a count-weighted least-squares
+// fit of log P(E) against E. The histograms restart once coin
+// burn-in is detected, so the initial uniform velocities drop out.
+// -------------------------------------------------------------
+static const int VELOCITY_BINS = 48;
+
+struct VelocityStats {
+    float     speedMax  = 0.f;     // histogram ranges, fixed at the first sample
+    float     energyMax = 0.f;
+    long long speed[VELOCITY_BINS]  = {0};
+    long long energy[VELOCITY_BINS] = {0};
+    long long entries   = 0;
+    double    sumEnergy = 0.0;
+    bool      afterBurnIn = false;
+    double    kTEquipartition = 0.0;
+    double    kTFit = 0.0;
+};
+static VelocityStats g_velocity;
+
+static void velocity_finish_sample() {
+    VelocityStats &v = g_velocity;
+    if (v.entries == 0) return;
+    v.kTEquipartition = v.sumEnergy / v.entries;
+
+    // Weighted fit of ln(density) = a - E / kT over non-empty bins
+    double width = v.energyMax / VELOCITY_BINS;
+    double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int b = 0; b < VELOCITY_BINS - 1; b++) {   // last bin also holds overflow
+        if (v.energy[b] == 0) continue;
+        double w = (double)v.energy[b];
+        double x = (b + 0.5) * width;
+        double y = std::log(v.energy[b] / (v.entries * width));
+        sw += w; sx += w * x; sy += w * y; sxx += w * x * x; sxy += w * x * y;
+    }
+    double denom = sw * sxx - sx * sx;
+    if (sw > 0 && denom > 0) {
+        double slope = (sw * sxy - sx * sy) / denom;
+        v.kTFit = slope < 0 ? -1.0 / slope : 0.0;
+    }
+}
+
+// -------------------------------------------------------------
+// Exact finite-N reference distribution
+//
+// exchange_coins moves each coin across independently with
+// probability 1/2, so coins behave as distinguishable and the
+// stationary law weights an assignment (c_1..c_N) by its multinomial
+// coefficient M! / (c_1! ... c_N!), with at most C coins per disk:
+//     E[disks with k coins] = N * G(N-1, M-k) / (k! G(N, M)),
+// where G(n, m) = [x^m] P(x)^n and P(x) = sum_{k<=C} x^k / k!.
+//
+// This is exact only while M <= C. exchange_coins clamps each side to
+// C afterwards, which destroys coins whenever a colliding pair holds
+// more than C, so for M > C the total drifts down and no fixed-M law
+// is stationary. There the curve is the capped multinomial law at the
+// starting M, a guide while losses are rare; --print-reference says
+// so and --check-engines does not test against it.
+//
+// G(n, m) is read off by Fourier inversion at the saddle point:
+// tilting by lambda^k (mean m/n) makes P(lambda x)^n / P(lambda)^n
+// the law of a sum of n bounded iid variables centred on m, and
+//     G(n, m) = P(lambda)^n lambda^-m (1/K) sum_t Re F(2 pi t / K),
+//     F(theta) = (P(lambda e^{i theta}) / P(lambda))^n e^{-i m theta}.
+// The K-point sum is exact up to aliasing from m +- K, so K = nC+1
+// when that is small and otherwise 40 standard deviations of the
+// sum, far below double precision. Each value takes O(C sqrt(n C))
+// time, every term has modulus at most 1 and nothing cancels.
+// -------------------------------------------------------------
+
+// log G(n, m) (-inf outside 0..n*cap)
+static double log_compositions(long long n, int cap, long long m) {
+    long long total = n * cap;
+    if (m < 0 || m > total) return -INFINITY;
+    std::vector<double> logWeight(cap + 1, 0.0);   // log 1/k!
+    for (int k = 1; k <= cap; k++) logWeight[k] = logWeight[k - 1] - std::log((double)k);
+    if (m == 0) return 0.0;
+    if (m == total) return n * logWeight[cap];
+
+    // Tilted weights w_k ~ lambda^k / k!, normalised; u = log lambda
+    std::vector<double> w(cap + 1);
+    double logNorm = 0.0;
+    auto tilt = [&](double u) {
+        double top = -INFINITY;
+        for (int k = 0; k <= cap; k++) top = std::max(top, k * u + logWeight[k]);
+        double sum = 0.0;
+        for (int k = 0; k <= cap; k++) sum += w[k] = std::exp(k * u + logWeight[k] - top);
+        for (auto &x : w) x /= sum;
+        logNorm = top + std::log(sum);
+        double mean = 0.0;
+        for (int k = 0; k <= cap; k++) mean += k * w[k];
+        return mean;
+    };
+    double target = (double)m / n, lo = -60.0, hi = 60.0;
+    for (int it = 0; it < 200; it++) {
+        double mid = 0.5 * (lo + hi);
+        (tilt(mid) < target ? lo : hi) = mid;
+    }
+    double u = 0.5 * (lo + hi);
+    double mean = tilt(u), var = 0.0;
+    for (int k = 0; k <= cap; k++) var += (k - mean) * (k - mean) * w[k];
+
+    long long K = (long long)std::ceil(40.0 * std::sqrt(n * var)) + 2 * cap + 16;
+    K = std::min(K, total + 1);
+    double sum = 0.0;
+    for (long long t = 0; t <= K / 2; t++) {
+        double theta = 2.0 * M_PI * t / K, re = 0.0, im = 0.0;
+        for (int k = 0; k <= cap; k++) {
+            re += w[k] * std::cos(k * theta);
+            im += w[k] * std::sin(k * theta);
+        }
+        double modulus = n * 0.5 * std::log(re * re + im * im);
+        if (modulus < -745.0) continue;
+        long double phase = (long double)n * std::atan2(im, re) - (long double)m * theta;
+        double term = std::exp(modulus) * std::cos((double)std::fmod(phase, 2.0L * M_PI));
+        // t and K - t are conjugate; t = K/2 is its own partner when K is even
+        sum += (t == 0 || 2 * t == K) ? term : 2.0 * term;
+    }
+    if (sum <= 0.0) return -INFINITY;
+    return n * logNorm - m * u + std::log(sum / K);
+}
+
+// Fills expected[0..cap] with the exact expected disk count per coin value
+void exact_reference(long long disks, long long coins, int cap, double *expected) {
+    double logZ = log_compositions(disks, cap, coins);
+    double logFactorial = 0.0;
+    for (int k = 0; k <= cap; k++) {
+        if (k > 0) logFactorial += std::log((double)k);
+        double lr = log_compositions(disks - 1, cap, coins - k);
+        expected[k] = std::isfinite(lr) ? disks * std::exp(lr - logFactorial - logZ) : 0.0;
+    }
+}
+
+// -------------------------------------------------------------
+// Autocorrelation: Flyvbjerg-Petersen online blocking
+//
+// Level l holds the means of consecutive blocks of 2^l samples.
+// Block means decorrelate as l grows, so the standard error of the
+// mean estimated from level l rises to a plateau; the largest
+// estimate over levels with enough blocks is taken. The integrated
+// autocorrelation time follows from var(mean) = 2 tau sigma^2 / n
+// (tau = 1/2 for independent samples).
+// -------------------------------------------------------------
+static const int BLOCKING_MIN_BLOCKS = 32;
+
+struct BlockingLevel {
+    long long n = 0;
+    double    sum = 0.0, sumSq = 0.0;
+    double    pending = 0.0;
+    bool      hasPending = false;
+};
+
+struct BlockingEstimator {
+    TrackedVector<BlockingLevel, MEM_STATISTICS> levels;
+
+    void add(double x) {
+        for (size_t l = 0; ; l++) {
+            if (l == levels.size()) levels.emplace_back();
+            BlockingLevel &L = levels[l];
+            L.n++;
+            L.sum   += x;
+            L.sumSq += x * x;
+            if (!L.hasPending) {
+                L.pending = x;
+                L.hasPending = true;
+                return;
+            }
+            x = 0.5 * (L.pending + x);
+            L.hasPending = false;
+        }
+    }
+
+    // Squared standard error of the mean at level l
+    double error2(size_t l) const {
+        const BlockingLevel &L = levels[l];
+        if (L.n < 2) return 0.0;
+        double var = (L.sumSq - L.sum * L.sum / L.n) / L.n;
+        return std::max(0.0, var / (L.n - 1));
+    }
+
+    double variance() const {
+        if (levels.empty() || levels[0].n < 2) return 0.0;
+        const BlockingLevel &L = levels[0];
+        return std::max(0.0, (L.sumSq - L.sum * L.sum / L.n) / L.n);
+    }
+
+    double tau() const {
+        if (levels.empty()) return 0.5;
+        double naive = error2(0);
+        if (naive <= 0.0) return 0.5;
+        double best = naive;
+        for (size_t l = 1; l < levels.size() && levels[l].n >= BLOCKING_MIN_BLOCKS; l++) {
+            best = std::max(best, error2(l));
+        }
+        return 0.5 * best / naive;
+    }
+
+    // Standard error of a mean over `samples` of these correlated samples
+    double std_error(long long samples) const {
+        if (samples <= 0) return 0.0;
+        return std::sqrt(2.0 * tau() * variance() / samples);
+    }
+};
+
+// One estimator per coin count, fed the number of disks per sample
+// from burn-in onwards
+static BlockingEstimator g_autocorr[9];
+
+// -------------------------------------------------------------
+// Equilibration: MSER-5 burn-in detection + windowed averages
+//
+// Every sample feeds the observable <coins^2> into batches of
+// MSER_BATCH. After each batch the MSER statistic
+//     sum_{i>=d} (b_i - mean_d)^2 / (B - d)^2
+// is minimised over truncation points d in the first half of the
+// B batch means; the first sample of the best batch marks the end
+// of burn-in. From then on averages cover the last g_windowSamples
+// samples after burn-in, kept as running sums over a ring of
+// per-sample histograms so nothing is ever rescanned.
+// -------------------------------------------------------------
+static const int MSER_BATCH       = 5;
+static const int MSER_MIN_BATCHES = 20;
+static const int MSER_MAX_BATCHES = 1024;
+
+struct EquilibriumSample {
+    float x;                 // collision_count when sampled
+    int   counts[9];
+};
+
+struct Equilibration {
+    bool      detected = false;
+    long long burnIn   = 0;           // first sample inside the window
+    float     burnInX  = 0.f;         // its collision_count, for the chart marker
+
+    // MSER batches
+    std::deque<double> batchMeans;
+    long long firstBatchSample = 0;   // sample index of batchMeans.front()
+    double    batchSum  = 0.0;
+    int       batchFill = 0;
+
+    // Window ring: sample s lives in ring[s % ring.size()]
+    TrackedVector<EquilibriumSample, MEM_STATISTICS> ring;
+    long long windowSums[9] = {0};
+    double    windowSumsSq[9] = {0.0};   // for the variance over the window itself
+    long long windowCount   = 0;
+    bool      floorWarned   = false;     // --target-error below the full window's error
+};
+static Equilibration g_equil;
+
+// Returns the truncation batch minimising MSER, or -1 if too early
+static int mser_truncation(const std::deque<double> &b) {
+    int n = (int)b.size();
+    if (n < MSER_MIN_BATCHES) return -1;
+    double sum = 0.0, sumSq = 0.0;
+    int best = -1;
+    double bestStat = 0.0;
+    // Walk d from the back so suffix sums build up incrementally
+    for (int d = n - 1; d >= 0; d--) {
+        sum   += b[d];
+        sumSq += b[d] * b[d];
+        int m = n - d;
+        if (d > n / 2) continue;
+        double ss = sumSq - sum * sum / m;
+        double stat = ss / ((double)m * m);
+        if (best < 0 || stat <= bestStat) {
+            best = d;
+            bestStat = stat;
+        }
+    }
+    // A minimum at the very edge of the search range means still drifting
+    return best < n / 2 ? best : -1;
+}
+
+void equilibration_add(const int counts[9], int agents, float x) {
+    Equilibration &eq = g_equil;
+    if (eq.ring.empty()) {
+        eq.ring.resize(g_windowSamples);
+    }
+    long long s = sample_count - 1;   // index of this sample
+    EquilibriumSample &slot = eq.ring[s % eq.ring.size()];
+    long long evicted = s - (long long)eq.ring.size();
+    if (eq.detected && evicted >= eq.burnIn) {
+        for (int i = 0; i < 9; i++) {
+            eq.windowSums[i]   -= slot.counts[i];
+            eq.windowSumsSq[i] -= (double)slot.counts[i] * slot.counts[i];
+        }
+        eq.windowCount--;
+    }
+    slot.x = x;
+    std::copy(counts, counts + 9, slot.counts);
+
+    if (eq.detected) {
+        for (int i = 0; i < 9; i++) {
+            eq.windowSums[i]   += counts[i];
+            eq.windowSumsSq[i] += (double)counts[i] * counts[i];
+            g_autocorr[i].add(counts[i]);
+        }
+        eq.windowCount++;
+        return;
+    }
+
+    // Feed the MSER batches with the mean squared coin count
+    double m2 = 0.0;
+    for (int i = 0; i < 9; i++) m2 += (double)i * i * counts[i];
+    eq.batchSum += m2 / agents;
+    if (++eq.batchFill < MSER_BATCH) return;
+    eq.batchMeans.push_back(eq.batchSum / MSER_BATCH);
+    eq.batchSum  = 0.0;
+    eq.batchFill = 0;
+    if ((int)eq.batchMeans.size() > MSER_MAX_BATCHES) {
+        eq.batchMeans.pop_front();
+        eq.firstBatchSample += MSER_BATCH;
+    }
+
+    int d = mser_truncation(eq.batchMeans);
+    if (d < 0) return;
+
+    // Burn-in found: seed the window from whatever the ring still holds
+    eq.detected = true;
+    eq.burnIn   = std::max(eq.firstBatchSample + (long long)d * MSER_BATCH,
+                           s + 1 - (long long)eq.ring.size());
+    eq.burnInX  = eq.ring[eq.burnIn % eq.ring.size()].x;
+    for (long long k = eq.burnIn; k <= s; k++) {
+        const EquilibriumSample &e = eq.ring[k % eq.ring.size()];
+        for (int i = 0; i < 9; i++) {
+            eq.windowSums[i]   += e.counts[i];
+            eq.windowSumsSq[i] += (double)e.counts[i] * e.counts[i];
+            g_autocorr[i].add(e.counts[i]);
+        }
+        eq.windowCount++;
+    }
+    eq.batchMeans.clear();
+}
+
+// Mean number of disks holding `coins` coins per sample, over the
+// equilibrated window once burn-in is detected, else over all samples
+double mean_disks_per_sample(int coins) {
+    if (g_equil.detected && g_equil.windowCount > 0) {
+        return (double)g_equil.windowSums[coins] / g_equil.windowCount;
+    }
+    return sample_count > 0 ? (double)cumulative_counts[coins] / sample_count : 0.0;
+}
+
+// Standard error of mean_disks_per_sample(coins), the mean over the
+// window: the window's own variance, with the autocorrelation time from
+// every sample since burn-in (more samples, same process). 0 until
+// burn-in is found.
+double mean_disks_std_error(int coins) {
+    const Equilibration &eq = g_equil;
+    if (!eq.detected || eq.windowCount < 2) return 0.0;
+    double n    = (double)eq.windowCount;
+    double mean = eq.windowSums[coins] / n;
+    double var  = std::max(0.0, eq.windowSumsSq[coins] / n - mean * mean);
+    return std::sqrt(2.0 * g_autocorr[coins].tau() * var / n);
+}
+
+// True once every coin fraction's standard error is at most `target`.
+// Once the window is full the error stops shrinking; if it is still
+// above target then, say so once (a longer --window is needed).
+bool errors_below(double target, int disks) {
+    Equilibration &eq = g_equil;
+    if (!eq.detected || eq.windowCount < BLOCKING_MIN_BLOCKS * 4) return false;
+    double worst = 0.0;
+    for (int i = 0; i < 9; i++) worst = std::max(worst, mean_disks_std_error(i) / disks);
+    if (worst <= target) return true;
+    if (!eq.floorWarned && eq.windowCount >= (long long)eq.ring.size()) {
+        eq.floorWarned = true;
+        std::cerr << "Note: a full window of " << eq.windowCount << " samples reaches a standard error of "
+                  << worst << ", above --target-error=" << target << "; raise --window\n";
+    }
+    return false;
+}
+
+// ---------------------------------------------------------
+// export_histogram: averaged coin histogram as CSV
+// ---------------------------------------------------------
+bool export_histogram(const std::string &path, int disks) {
+    AsyncOfstream out(path);
+    if (!out) return false;
+    out << "# disk_sim coin histogram\n"
+        << "# disks=" << disks << " samples=" << sample_count
+        << " collisions=" << collision_count
+        << " burn_in_sample=" << (g_equil.detected ? g_equil.burnIn : -1)
+        << " window=" << (g_equil.detected ? g_equil.windowCount : sample_count) << "\n"
+        << "# ergodicity_gap_mean=" << g_ergodicityGapMean
+        << " ergodicity_gap_max=" << g_ergodicityGapMax << "\n"
+        << "# kT_equipartition=" << g_velocity.kTEquipartition
+        << " kT_fit=" << g_velocity.kTFit << "\n";
+    for (int t = 0; t < MEM_TAGS; t++) {
+        out << "# memory " << MEM_TAG_NAMES[t] << ": bytes="
+            << g_memory[t].bytes.load(std::memory_order_relaxed) << " allocations="
+            << g_memory[t].allocations.load(std::memory_order_relaxed) << "\n";
+    }
+    out << "coins,mean_disks,fraction,std_error,tau,exact_mean_disks\n";
+    for (int i = 0; i < 9; i++) {
+        double mean = mean_disks_per_sample(i);
+        out << i << "," << mean << "," << mean / disks << ","
+            << mean_disks_std_error(i) / disks << "," << g_autocorr[i].tau() << ","
+            << g_exactReference[i] << "\n";
+    }
+    return out.close();
+}
+
+// -------------------------------------------------------------
+// Shared-memory ring for live consumers (--shm=NAME)
+//
+// A POSIX shared-memory object with a ring of chart samples and,
+// with --shm-disks, a smaller ring of whole disk frames. The
+// simulation is the only writer; readers map it read-only, so any
+// number of them can attach without slowing it down. Every slot
+// carries a sequence number: 2n+1 while item n is being written,
+// 2n+2 once it is complete. A reader copies a slot and keeps it only
+// if the number was 2n+2 both before and after the copy. The header
+// records the writer's pid, so a reader also stops when the writer
+// was killed before it could mark the ring closed.
+// -------------------------------------------------------------
+static const uint64_t SHM_MAGIC        = 0x314d485353444ull;  // "DSSHM1"
+static const uint32_t SHM_VERSION      = 2;
+static const uint32_t SHM_SAMPLE_SLOTS = 1024;
+static const uint32_t SHM_FRAME_SLOTS  = 3;
+
+enum ShmDiskFormat : uint32_t {
+    SHM_NO_DISKS = 0,
+    SHM_DISKS    = 1,   // struct Disk, 24 bytes
+    SHM_COMPACT  = 2    // struct CompactDisk, 16 bytes
+};
+
+struct ShmSample {
+    std::atomic<uint64_t> seq;
+    long long sample, step, collisions, disks;
+    int       counts[9];     // disks holding k coins in this sample
+    float     fraction[9];   // averaged disks per coin count, as plotted
+    double    gini;
+};
+
+struct alignas(64) ShmFrame {
+    std::atomic<uint64_t> seq;
+    long long step;
+    long long disks;
+    // followed by `disks` disks in the header's format
+};
+
+struct ShmHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t sampleSlots;
+    uint32_t frameSlots;
+    uint32_t diskFormat;      // ShmDiskFormat
+    uint64_t diskBytes;       // bytes per disk
+    uint64_t frameCapacity;   // disks per frame slot
+    uint64_t frameOffset;     // first frame slot, from the start of the mapping
+    uint64_t frameStride;     // bytes per frame slot
+    int64_t  writerPid;       // process that created the ring
+    std::atomic<uint64_t> samples;   // samples published so far
+    std::atomic<uint64_t> frames;    // frames published so far
+    std::atomic<uint32_t> closed;    // writer has exited
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be address-free");
+
+struct ShmRing {
+    std::string name;
+    ShmHeader  *header = nullptr;
+    size_t      bytes  = 0;
+
+    ~ShmRing() {
+#if defined(__linux__) || defined(__APPLE__)
+        if (!header) return;
+        header->closed.store(1, std::memory_order_release);
+        munmap(header, bytes);
+        shm_unlink(name.c_str());
+#endif
+    }
+};
+static ShmRing g_shm;
+
+inline ShmSample *shm_samples(ShmHeader *h) {
+    return reinterpret_cast<ShmSample *>(h + 1);
+}
+
+inline ShmFrame *shm_frame(ShmHeader *h, uint64_t slot) {
+    return reinterpret_cast<ShmFrame *>(reinterpret_cast<char *>(h) + h->frameOffset +
+                                        slot * h->frameStride);
+}
+
+// POSIX shm names start with one slash
+inline std::string shm_path(const std::string &name) {
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+// Create the ring; frames of up to `disks` disks when format is not SHM_NO_DISKS.
+// Fails, with errno set, if the name is already taken: it may belong to a
+// live run, so it is never unlinked here.
+bool shm_init(const std::string &name, ShmDiskFormat format, size_t disks) {
+#if defined(__linux__) || defined(__APPLE__)
+    size_t diskBytes = format == SHM_COMPACT ? sizeof(CompactDisk)
+                     : format == SHM_DISKS   ? sizeof(Disk) : 0;
+    size_t frameOffset = (sizeof(ShmHeader) + SHM_SAMPLE_SLOTS * sizeof(ShmSample) + 63) & ~(size_t)63;
+    size_t frameStride = (sizeof(ShmFrame) + disks * diskBytes + 63) & ~(size_t)63;
+    uint32_t frames    = diskBytes > 0 ? SHM_FRAME_SLOTS : 0;
+    size_t bytes = frameOffset + frames * frameStride;
+
+    std::string path = shm_path(name);
+    int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) return false;
+    bool ok = ftruncate(fd, (off_t)bytes) == 0;
+    void *p = ok ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    int err = errno;
+    close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(path.c_str());
+        errno = err;
+        return false;
+    }
+    ShmHeader *h = static_cast<ShmHeader *>(p);   // zero-filled by ftruncate
+    h->version       = SHM_VERSION;
+    h->sampleSlots   = SHM_SAMPLE_SLOTS;
+    h->frameSlots    = frames;
+    h->diskFormat    = frames ? format : SHM_NO_DISKS;
+    h->diskBytes     = diskBytes;
+    h->frameCapacity = disks;
+    h->frameOffset   = frameOffset;
+    h->frameStride   = frameStride;
+    h->writerPid     = (int64_t)getpid();
+    std::atomic_thread_fence(std::memory_order_release);
+    h->magic = SHM_MAGIC;    // last, so readers never see a half-built header
+    g_shm.name   = path;
+    g_shm.header = h;
+    g_shm.bytes  = bytes;
+    return true;
+#else
+    (void)name; (void)format; (void)disks;
+    return false;
+#endif
+}
+
+void shm_publish_sample(const int counts[9], size_t disks, double gini) {
+    ShmHeader *h = g_shm.header;
+    if (!h) return;
+    uint64_t n = h->samples.load(std::memory_order_relaxed);
+    ShmSample &s = shm_samples(h)[n % h->sampleSlots];
+    s.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.sample     = sample_count;
+    s.step       = step_count;
+    s.collisions = collision_count;
+    s.disks      = (long long)disks;
+    for (int i = 0; i < 9; i++) {
+        s.counts[i]   = counts[i];
+        s.fraction[i] = g_coinFraction[i];
+    }
+    s.gini = gini;
+    s.seq.store(2 * n + 2, std::memory_order_release);
+    h->samples.store(n + 1, std::memory_order_release);
+}
+
+// One frame's disks, straight from the frame snapshot
+template <class Store>
+void shm_publish_frame(const Store &disks) {
+    ShmHeader *h = g_shm.header;
+    if (!h || h->frameSlots == 0) return;
+    TraceScope trace("shm frame");
+    size_t bytes = std::min<size_t>(disks.size(), h->frameCapacity) * sizeof(disks[0]);
+    if (sizeof(disks[0]) != h->diskBytes) return;
+    uint64_t n = h->frames.load(std::memory_order_relaxed);
+    ShmFrame *f = shm_frame(h, n % h->frameSlots);
+    f->seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    f->step  = step_count;
+    f->disks = (long long)(bytes / h->diskBytes);
+    std::memcpy(reinterpret_cast<char *>(f) + sizeof(ShmFrame), disks.data(), bytes);
+    f->seq.store(2 * n + 2, std::memory_order_release);
+    h->frames.store(n + 1, std::memory_order_release);
+}
+
+// --shm-read=NAME: follow another run's ring and print its samples as
+// CSV until that run exits
+int shm_read(const std::string &name) {
+#if defined(__linux__) || defined(__APPLE__)
+    std::string path = shm_path(name);
+    int fd = shm_open(path.c_str(), O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmHeader)) {
+        if (fd >= 0) close(fd);
+        std::cerr << "No shared-memory ring " << path << "\n";
+        return 1;
+    }
+    void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return 1;
+    const ShmHeader *h = static_cast<const ShmHeader *>(p);
+    if (h->magic != SHM_MAGIC || h->version != SHM_VERSION) {
+        std::cerr << path << " is not a disk_sim ring\n";
+        munmap(p, (size_t)st.st_size);
+        return 1;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const ShmSample *slots = reinterpret_cast<const ShmSample *>(h + 1);
+
+    std::cout << "sample,step,collisions,disks,gini";
+    for (int k = 0; k < 9; k++) std::cout << ",n" << k;
+    for (int k = 0; k < 9; k++) std::cout << ",f" << k;
+    std::cout << "\n";
+    uint64_t next = 0;
+    long long dropped = 0;
+    bool orphaned = false;
+    for (;;) {
+        bool closed = h->closed.load(std::memory_order_acquire) != 0;
+        if (!closed && kill((pid_t)h->writerPid, 0) != 0 && errno == ESRCH) {
+            closed = orphaned = true;   // drain what it published, then stop
+        }
+        uint64_t published = h->samples.load(std::memory_order_acquire);
+        if (published - next > h->sampleSlots) {
+            dropped += (long long)(published - h->sampleSlots - next);
+            next = published - h->sampleSlots;
+        }
+        for (; next < published; next++) {
+            const ShmSample &slot = slots[next % h->sampleSlots];
+            uint64_t before = slot.seq.load(std::memory_order_acquire);
+            ShmSample s;
+            std::memcpy((void *)&s, (const void *)&slot, sizeof(s));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (before != 2 * next + 2 || slot.seq.load(std::memory_order_relaxed) != before) {
+                dropped++;      // overwritten while we copied it
+                continue;
+            }
+            std::cout << s.sample << "," << s.step << "," << s.collisions << "," << s.disks
+                      << "," << s.gini;
+            for (int k = 0; k < 9; k++) std::cout << "," << s.counts[k];
+            for (int k = 0; k < 9; k++) std::cout << "," << s.fraction[k];
+            std::cout << "\n";
+        }
+        std::cout.flush();
+        if (closed) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    if (dropped > 0) std::cerr << "Reader fell behind: " << dropped << " samples skipped\n";
+    if (orphaned) {
+        std::cerr << "Writer " << h->writerPid << " exited without closing " << path
+                  << "; remove it with rm /dev/shm" << path << "\n";
+    }
+    munmap(p, (size_t)st.st_size);
+    return orphaned ? 1 : 0;
+#else
+    (void)name;
+    return 1;
+#endif
+}
+
+// -------------------------------------------------------------
+// update_plot: record fraction of disks with 0..8 coins
+// also store them in g_coinFraction
+// -------------------------------------------------------------
+// One chart sample, accumulated over a disk store or over many tiles
+struct PlotSample {
+    int       counts[9] = {0};
+    long long speed[VELOCITY_BINS]  = {0};
+    long long energy[VELOCITY_BINS] = {0};
+    double    sumEnergy = 0.0;
+    size_t    disks = 0;
+    double    gini = 0.0;       // live coin tracker, read before the sample goes async
+};
+
+// The parts of a sample that read live engine state (g(r) bins, per-disk
+// occupancy counters, the coin inequality trees). Runs between steps;
+// update_plot then only needs the frame snapshot and the returned sample
+// and can overlap the next step.
+template <class Store>
+PlotSample capture_live_stats(const Store &disks) {
+    rdf_reduce();
+    ErgodicityGap gap = ergodicity_gap(disks);
+    g_ergodicityGapMean = gap.mean;
+    g_ergodicityGapMax  = gap.max;
+    PlotSample sample;
+    sample.gini = coin_gini();
+    return sample;
+}
+
+// The velocity histograms (re)start at the first sample and once
+// burn-in is detected, with ranges from the current mean energy
+bool plot_needs_ranges() {
+    return g_velocity.speedMax == 0.f || (g_equil.detected && !g_velocity.afterBurnIn);
+}
+
+void plot_set_ranges(double meanEnergy) {
+    VelocityStats &vel = g_velocity;
+    double kT = std::max(1e-6, meanEnergy);
+    vel = VelocityStats();
+    vel.speedMax    = (float)(4.5 * std::sqrt(kT));
+    vel.energyMax   = (float)(10.0 * kT);
+    vel.afterBurnIn = g_equil.detected;
+}
+
+template <class Store>
+double kinetic_energy(const Store &disks) {
+    double e = 0.0;
+    for (auto &c : disks) {
+        const Disk &d = unpack(c);
+        e += 0.5 * (d.vx*d.vx + d.vy*d.vy);
+    }
+    return e;
+}
+
+// how many disks have each coin count, plus speed and energy bins,
+// as per-chunk partials folded in chunk order
+template <class Store>
+void plot_accumulate(const Store &disks, PlotSample &sample) {
+    float speedScale  = VELOCITY_BINS / g_velocity.speedMax;
+    float energyScale = VELOCITY_BINS / g_velocity.energyMax;
+    std::vector<PlotSample> partials(pool_size());
+    parallel_for(disks.size(), PARALLEL_MIN_CHUNK, [&](size_t from, size_t to, int chunk) {
+        PlotSample &part = partials[chunk];
+        for (size_t i = from; i < to; i++) {
+            const Disk &d = unpack(disks[i]);
+            part.counts[d.coin_count]++;
+            float v2 = d.vx*d.vx + d.vy*d.vy;
+            float e  = 0.5f * v2;
+            part.sumEnergy += e;
+            part.speed[std::min(VELOCITY_BINS - 1, (int)(std::sqrt(v2) * speedScale))]++;
+            part.energy[std::min(VELOCITY_BINS - 1, (int)(e * energyScale))]++;
+        }
+    });
+    for (const PlotSample &part : partials) {
+        for (int i = 0; i < 9; i++) sample.counts[i] += part.counts[i];
+        for (int b = 0; b < VELOCITY_BINS; b++) {
+            sample.speed[b]  += part.speed[b];
+            sample.energy[b] += part.energy[b];
+        }
+        sample.sumEnergy += part.sumEnergy;
+    }
+    sample.disks += disks.size();
+}
+
+// Fold one sample into the velocity histograms, the running totals
+// and the chart history
+void plot_record(const PlotSample &sample) {
+    VelocityStats &vel = g_velocity;
+    const int *counts = sample.counts;
+    for (int b = 0; b < VELOCITY_BINS; b++) {
+        vel.speed[b]  += sample.speed[b];
+        vel.energy[b] += sample.energy[b];
+    }
+    vel.entries   += (long long)sample.disks;
+    vel.sumEnergy += sample.sumEnergy;
+    velocity_finish_sample();
+
+    // update global cumulative_counts
+    for (int i = 0; i < 9; i++) {
+        cumulative_counts[i] += counts[i];
+    }
+    sample_count++;
+    equilibration_add(counts, (int)sample.disks, static_cast<float>(collision_count));
+
+    // push back fraction
+    for (int i = 0; i < 9; i++) {
+        xdata[i].push_back(static_cast<float>(collision_count));
+
+        // Disks per sample: over all samples until burn-in is detected,
+        // then over the equilibrated window (same units either way)
+        float avgNum = static_cast<float>(mean_disks_per_sample(i));
+        ydata[i].push_back(avgNum);
+        g_coinFraction[i] = avgNum;
+    }
+    shm_publish_sample(counts, sample.disks, sample.gini);
+}
+// `sample` comes from capture_live_stats and is filled from the snapshot
+template <class Store>
+void update_plot(const Store &disks, PlotSample &sample) {
+    TraceScope trace("stats");
+    if (plot_needs_ranges()) plot_set_ranges(kinetic_energy(disks) / disks.size());
+    plot_accumulate(disks, sample);
+    plot_record(sample);
+}
+
+
+// -------------------------------------------------------------
+// Frame arena: storage for vertices and strings that only live for
+// one frame. arena_alloc bumps a pointer; arena_reset at the end of
+// the frame rewinds it, first growing the block if the frame spilled,
+// so steady frames make no heap allocations. Main thread only.
+// -------------------------------------------------------------
+struct FrameArena {
+    TrackedVector<char, MEM_RENDER> block;
+    size_t used     = 0;
+    size_t overflow = 0;                                // spilled bytes this frame
+    std::vector<TrackedVector<char, MEM_RENDER>> spills;
+};
+static FrameArena g_frameArena;
+
+void *arena_alloc(size_t bytes, size_t align = alignof(std::max_align_t)) {
+    FrameArena &a = g_frameArena;
+    uintptr_t base  = (uintptr_t)a.block.data();
+    uintptr_t start = (base + a.used + align - 1) & ~(uintptr_t)(align - 1);
+    if (!a.block.empty() && start + bytes <= base + a.block.size()) {
+        a.used = start + bytes - base;
+        return (void *)start;
+    }
+    a.spills.emplace_back(bytes + align);
+    a.overflow += bytes + align;
+    uintptr_t spill = (uintptr_t)a.spills.back().data();
+    return (void *)((spill + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+void arena_reset() {
+    static const size_t ARENA_MIN_BYTES = 64 * 1024;
+    FrameArena &a = g_frameArena;
+    if (a.overflow > 0) {
+        size_t size = std::max(ARENA_MIN_BYTES, 2 * (a.block.size() + a.overflow));
+        a.spills.clear();
+        a.block = TrackedVector<char, MEM_RENDER>();
+        a.block.resize(size);
+    }
+    a.used = 0;
+    a.overflow = 0;
+}
+
+// printf into the arena; the string is valid until arena_reset
+const char *arena_printf(const char *fmt, ...) {
+    va_list args, copy;
+    va_start(args, fmt);
+    va_copy(copy, args);
+    int n = std::vsnprintf(nullptr, 0, fmt, copy);
+    va_end(copy);
+    char *out = static_cast<char *>(arena_alloc((size_t)std::max(0, n) + 1, 1));
+    std::vsnprintf(out, (size_t)std::max(0, n) + 1, fmt, args);
+    va_end(args);
+    return out;
+}
+
+template <class T>
+struct ArenaAllocator {
+    using value_type = T;
+    ArenaAllocator() = default;
+    template <class U> ArenaAllocator(const ArenaAllocator<U> &) {}
+    T *allocate(size_t n) { return static_cast<T *>(arena_alloc(n * sizeof(T), alignof(T))); }
+    void deallocate(T *, size_t) {}
+};
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return true; }
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return false; }
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Axis-aligned rectangle as two triangles
+void push_rect(ArenaVector<sf::Vertex> &out, float x, float y, float w, float h, sf::Color color) {
+    const sf::Vector2f corners[6] = {{x, y}, {x + w, y}, {x, y + h},
+                                     {x + w, y}, {x + w, y + h}, {x, y + h}};
+    for (const sf::Vector2f &c : corners) {
+        sf::Vertex v;
+        v.position = c;
+        v.color    = color;
+        out.push_back(v);
+    }
+}
+
+// sf::Text objects kept across frames. The string (and the origin, at
+// `anchor` times the text's size) is only updated when it changes, so
+// labels that hold still rebuild no glyph geometry. The texts and an
+// estimate of their glyph quads (6 vertices per character) are counted
+// under the render tag.
+static long long text_bytes(size_t chars) {
+    return (long long)(sizeof(sf::Text) + chars * 6 * sizeof(sf::Vertex));
+}
+
+struct TextSlots {
+    TrackedVector<std::unique_ptr<sf::Text>, MEM_RENDER> texts;
+    TrackedVector<std::string, MEM_RENDER> strings;
+    long long bytes = 0;   // held by the texts, already in g_memory
+
+    ~TextSlots() { g_memory[MEM_RENDER].bytes.fetch_sub(bytes, std::memory_order_relaxed); }
+};
+
+sf::Text &slot_text(TextSlots &slots, size_t i, const char *str, unsigned size,
+                    sf::Vector2f anchor = sf::Vector2f(0.f, 0.f)) {
+    long long before = slots.bytes;
+    while (slots.texts.size() <= i) {
+        slots.texts.push_back(std::make_unique<sf::Text>(g_font, "", size));
+        slots.strings.emplace_back();
+        slots.bytes += text_bytes(0);
+        g_memory[MEM_RENDER].allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    sf::Text &text = *slots.texts[i];
+    if (slots.strings[i] != str) {
+        slots.bytes += text_bytes(std::strlen(str)) - text_bytes(slots.strings[i].size());
+        slots.strings[i] = str;
+        text.setString(str);
+        auto bounds = text.getLocalBounds();
+        text.setOrigin(sf::Vector2f(bounds.size.x * anchor.x, bounds.size.y * anchor.y));
+    }
+    g_memory[MEM_RENDER].bytes.fetch_add(slots.bytes - before, std::memory_order_relaxed);
+    return text;
+}
+
+// -------------------------------------------------------------
+// Frame snapshot and disk geometry. Each frame draws (and samples)
+// a copy of step t while the engine computes step t+1; the disk
+// circles are built into one triangle list off the main thread,
+// CIRCLE_POINTS per disk as in sf::CircleShape. Circles cost 90
+// vertices a disk, so past MAX_DISK_CIRCLES each disk is one point,
+// and past MAX_DISK_POINTS only every k-th disk is drawn.
+// -------------------------------------------------------------
+static const int CIRCLE_POINTS = 30;
+static const size_t MAX_DISK_LABELS  = 1000;      // coin-count labels drawn up to this many disks
+static const size_t MAX_DISK_CIRCLES = 10000;     // about 18 MB of triangles
+static const size_t MAX_DISK_POINTS  = 1 << 20;   // about 20 MB of points
+static DiskStore g_frameSnapshot;
+static CompactStore g_compactSnapshot;
+
+struct DiskGeometry {
+    TrackedVector<sf::Vertex, MEM_RENDER> vertices;
+    sf::PrimitiveType type = sf::PrimitiveType::Triangles;
+};
+static DiskGeometry g_diskGeometry;
+
+DiskStore &frame_snapshot(const DiskStore &)       { return g_frameSnapshot; }
+CompactStore &frame_snapshot(const CompactStore &) { return g_compactSnapshot; }
+
+template <class Store>
+void take_snapshot(const Store &disks, Store &snapshot) {
+    snapshot.resize(disks.size());
+    parallel_for(disks.size(), PARALLEL_MIN_CHUNK, [&](size_t from, size_t to, int) {
+        std::copy(disks.begin() + from, disks.begin() + to, snapshot.begin() + from);
+    });
+}
+
+template <class Store>
+void prepare_disk_vertices(const Store &disks, DiskGeometry &geometry) {
+    TraceScope trace("disk vertices");
+    const sf::Color fill(0, 128, 255);
+    auto &out = geometry.vertices;
+    if (disks.size() > MAX_DISK_CIRCLES) {
+        size_t stride = (disks.size() + MAX_DISK_POINTS - 1) / MAX_DISK_POINTS;
+        geometry.type = sf::PrimitiveType::Points;
+        out.resize((disks.size() + stride - 1) / stride);
+        parallel_for(out.size(), PARALLEL_MIN_CHUNK, [&](size_t from, size_t to, int) {
+            for (size_t i = from; i < to; i++) {
+                const Disk &d = unpack(disks[i * stride]);
+                out[i].position = sf::Vector2f(d.x, d.y);
+                out[i].color    = fill;
+            }
+        });
+        return;
+    }
+    geometry.type = sf::PrimitiveType::Triangles;
+    float unit[CIRCLE_POINTS + 1][2];
+    for (int k = 0; k <= CIRCLE_POINTS; k++) {
+        float a = k * 2.f * 3.14159265f / CIRCLE_POINTS - 3.14159265f / 2.f;
+        unit[k][0] = std::cos(a);
+        unit[k][1] = std::sin(a);
+    }
+    out.resize(disks.size() * CIRCLE_POINTS * 3);
+    parallel_for(disks.size(), PARALLEL_MIN_CHUNK, [&](size_t from, size_t to, int) {
+        for (size_t i = from; i < to; i++) {
+            const Disk &d = unpack(disks[i]);
+            sf::Vertex *v = &out[i * CIRCLE_POINTS * 3];
+            for (int k = 0; k < CIRCLE_POINTS; k++) {
+                v[3*k].position     = sf::Vector2f(d.x, d.y);
+                v[3*k + 1].position = sf::Vector2f(d.x + d.radius * unit[k][0],
+                                                   d.y + d.radius * unit[k][1]);
+                v[3*k + 2].position = sf::Vector2f(d.x + d.radius * unit[k + 1][0],
+                                                   d.y + d.radius * unit[k + 1][1]);
+                v[3*k].color = v[3*k + 1].color = v[3*k + 2].color = fill;
+            }
+        }
+    });
+}
+
+// ---------------------------------------------
+// draw_line_graph: bottom 200px, range 0..0.5
+// with tick marks 0.0..0.5
+// ---------------------------------------------
+void draw_line_graph(sf::RenderWindow &window) {
+    TraceScope trace("chart");
+    if (collision_count < 1) {
+        return; // no data yet
+    }
+    static TextSlots tickLabels;
+
+    float chartX     = 0.f;
+    float chartY     = CHART_TOP;
+    float chartWidth = (float)WIDTH;
+    float chartHt    = CHART_HEIGHT;
+
+    // Axes, ticks and the burn-in marker go out as one triangle list
+    ArenaVector<sf::Vertex> rects;
+    rects.reserve(6 * 10);
+
+    // X-axis
+    push_rect(rects, chartX, chartY + chartHt - 1.f, chartWidth, 1.f, sf::Color::White);
+
+    // Y-axis
+    push_rect(rects, chartX, chartY, 1.f, chartHt, sf::Color::White);
+
+    // Range 0..disk count (0..6 by default):
+    float chartMax = (float)g_diskCount;
+    auto scaleY = [&](float val) {
+        if (val > chartMax) val = chartMax;
+        float proportion = val / chartMax; // 0..1
+        return chartY + chartHt - (proportion * chartHt);
+    };
+
+    // scaleX (0..collision_count => 0..chartWidth)
+    auto scaleX = [&](float xVal) {
+        if (collision_count == 0) return chartX;
+        return chartX + (xVal / (float)collision_count) * chartWidth;
+    };
+
+    // Burn-in marker: averages to the right cover the equilibrated window
+    if (g_equil.detected) {
+        push_rect(rects, scaleX(g_equil.burnInX), chartY, 1.f, chartHt, sf::Color(90, 90, 90));
+    }
+
+    // Six tick steps over 0..chartMax:
+    for (int tickIdx = 0; tickIdx <= 6; tickIdx++) {
+        float val  = chartMax * tickIdx / 6.f;
+        float yPos = scaleY(val);
+
+        // short tick line
+        push_rect(rects, chartX - 2.f, yPos, 5.f, 1.f, sf::Color::White);
+    }
+    window.draw(rects.data(), rects.size(), sf::PrimitiveType::Triangles);
+
+    // Tick labels: use fixed decimal (1 digit or so)
+    for (int tickIdx = 0; tickIdx <= 6; tickIdx++) {
+        float val = chartMax * tickIdx / 6.f;
+        sf::Text &label = slot_text(tickLabels, tickIdx, arena_printf("%.1f", val), 12,
+                                    sf::Vector2f(1.f, 0.5f));
+        label.setPosition(sf::Vector2f(chartX + 8.f, scaleY(val)));
+        label.setFillColor(sf::Color::White);
+        window.draw(label);
+    }
+
+    // 9 lines (0..8 coin counts)
+    sf::Color colors[9] = {
+        sf::Color::Blue, sf::Color::Red, sf::Color::Green,
+        sf::Color::Cyan, sf::Color::Magenta, sf::Color::Yellow,
+        sf::Color::White, sf::Color(128,128,128), sf::Color(255,127,0)
+    };
+
+    for (int i = 0; i < 9; i++) {
+        ArenaVector<sf::Vertex> lineStrip(xdata[i].size());
+        for (size_t k = 0; k < xdata[i].size(); k++) {
+            lineStrip[k].position = sf::Vector2f(scaleX(xdata[i][k]), scaleY(ydata[i][k]));
+            lineStrip[k].color    = colors[i];
+        }
+        window.draw(lineStrip.data(), lineStrip.size(), sf::PrimitiveType::LineStrip);
+    }
+
+    // Exact finite-N reference, dashed in each line's colour
+    ArenaVector<sf::Vertex> dashes;
+    dashes.reserve(9 * 2 * (size_t)(chartWidth / 12.f + 1.f));
+    for (int i = 0; i < 9; i++) {
+        float py = scaleY((float)g_exactReference[i]);
+        for (float px = chartX + 12.f; px + 6.f < chartX + chartWidth; px += 12.f) {
+            sf::Vertex a, b;
+            a.position = sf::Vector2f(px, py);
+            b.position = sf::Vector2f(px + 6.f, py);
+            a.color = b.color = colors[i];
+            dashes.push_back(a);
+            dashes.push_back(b);
+        }
+    }
+    window.draw(dashes.data(), dashes.size(), sf::PrimitiveType::Lines);
+
+    // Companion engines, dimmed, each on its own x range
+    const CompanionSeries *companions[] = {&g_latticeSeries, &g_graphSeries};
+    for (const CompanionSeries *series : companions) {
+        if (series->samples < 2) continue;
+        float xMax = std::max(1.f, series->xdata[0].back());
+        for (int i = 0; i < 9; i++) {
+            sf::Color dim = colors[i];
+            dim.a = 110;
+            ArenaVector<sf::Vertex> lineStrip(series->xdata[i].size());
+            for (size_t k = 0; k < series->xdata[i].size(); k++) {
+                lineStrip[k].position = sf::Vector2f(chartX + series->xdata[i][k] / xMax * chartWidth,
+                                                     scaleY(series->ydata[i][k]));
+                lineStrip[k].color    = dim;
+            }
+            window.draw(lineStrip.data(), lineStrip.size(), sf::PrimitiveType::LineStrip);
+        }
+    }
+}
+
+// ----------------------------------------------------
+// draw_stats_window: show the 9 fractions with 3 decimals
+// ----------------------------------------------------
+void draw_stats_window(sf::RenderWindow &stats) {
+    TraceScope trace("stats window");
+    static TextSlots texts;
+    auto line = [&](size_t slot, const char *str, unsigned size, sf::Color color, float y) {
+        sf::Text &text = slot_text(texts, slot, str, size);
+        text.setFillColor(color);
+        text.setPosition(sf::Vector2f(10.f, y));
+        stats.draw(text);
+    };
+    const sf::Color grey(200, 200, 200);
+
+    // Just clear to dark grey
+    stats.clear(sf::Color(50, 50, 50));
+
+    // Title
+    line(0, "Coin Fractions", 18, sf::Color::White, 10.f);
+
+    // Now show total collisions:
+    line(1, arena_printf("Collisions: %lld", collision_count), 16, sf::Color::White, 35.f);
+
+    // Burn-in status
+    line(2, g_equil.detected
+            ? arena_printf("Equilibrated: window %lld samples", g_equil.windowCount)
+            : arena_printf("Burn-in: %lld samples", sample_count),
+         14, grey, 60.f);
+
+    // Quantiles and Gini of the current holdings
+    line(3, arena_printf("Med %d  p90 %d  p99 %d  Gini %.3f", coin_quantile(0.5),
+                         coin_quantile(0.9), coin_quantile(0.99), coin_gini()),
+         14, grey, 85.f);
+
+    // Per-disk time averages vs the ensemble
+    line(4, arena_printf("Ergodicity gap %.3f (max %.3f)", g_ergodicityGapMean, g_ergodicityGapMax),
+         14, grey, 110.f);
+
+    // For each coin count 0..8, show fraction w/ 3 decimals
+    float yOffset = 135.f;
+
+    for (int c = 0; c < 9; c++) {
+        const char *str = g_equil.detected
+            ? arena_printf("%d coins = %.2f +/- %.3f  (tau %.1f)", c, g_coinFraction[c],
+                           mean_disks_std_error(c), g_autocorr[c].tau())
+            : arena_printf("%d coins = %.2f", c, g_coinFraction[c]);
+        line(5 + c, str, 14, sf::Color::White, yOffset);
+        yOffset += 25.f;
+    }
+
+    // Live bytes / allocations per subsystem
+    for (int t = 0; t <= MEM_TAGS; t++) {
+        const char *str;
+        if (t < MEM_TAGS) {
+            str = arena_printf("%s: %s in %lld allocs", MEM_TAG_NAMES[t],
+                               format_bytes((double)g_memory[t].bytes.load(std::memory_order_relaxed)).c_str(),
+                               g_memory[t].allocations.load(std::memory_order_relaxed));
+        } else {
+            long long rss = memory_resident();
+            str = arena_printf("tracked %s%s%s%s%s",
+                               format_bytes((double)memory_total()).c_str(),
+                               rss >= 0 ? ", resident " : "",
+                               rss >= 0 ? format_bytes((double)rss).c_str() : "",
+                               g_memBudget > 0.0 ? " / budget " : "",
+                               g_memBudget > 0.0 ? format_bytes(g_memBudget).c_str() : "");
+        }
+        line(14 + t, str, 12, grey, yOffset + 5.f);
+        yOffset += 17.f;
+    }
+
+    stats.display();
+}
+
+// ---------------------------------------------------------
+// Warm start: initial coins drawn from a saved histogram
+// ---------------------------------------------------------
+
+// Reads "coins,mean_disks,fraction" (as written by export_histogram) or
+// plain "coins,weight" rows; '#' lines and the header are skipped.
+bool load_coin_histogram(const std::string &path, std::vector<double> &weights) {
+    std::ifstream in(path);
+    if (!in) return false;
+    weights.assign(MAX_COINS_PER_DISK + 1, 0.0);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#' || !std::isdigit((unsigned char)line[0])) continue;
+        std::vector<double> cols;
+        std::stringstream ss(line);
+        std::string cell;
+        while (std::getline(ss, cell, ',')) {
+            cols.push_back(std::atof(cell.c_str()));
+        }
+        if (cols.size() < 2) continue;
+        int k = (int)cols[0];
+        if (k < 0 || k > MAX_COINS_PER_DISK) continue;
+        weights[k] = cols.size() >= 3 ? cols[2] : cols[1];
+    }
+    double total = 0.0;
+    for (double w : weights) total += std::max(0.0, w);
+    return total > 0.0;
+}
+
+// Multinomial draw of each disk's coins from the histogram, nudged one
+// coin at a time on random disks until exactly `coins` are held, then
+// shuffled across disks.
+std::vector<int> sample_coin_distribution(const std::vector<double> &weights,
+                                          int disks, int coins, std::mt19937 &rng) {
+    std::vector<double> w(weights);
+    for (double &x : w) x = std::max(0.0, x);
+    std::discrete_distribution<int> draw(w.begin(), w.end());
+    std::vector<int> result(disks);
+    long long held = 0;
+    for (int &c : result) {
+        c = draw(rng);
+        held += c;
+    }
+
+    std::uniform_int_distribution<int> pick(0, disks - 1);
+    while (held != coins) {
+        int &c = result[pick(rng)];
+        if (held < coins && c < MAX_COINS_PER_DISK) {
+            c++;
+            held++;
+        } else if (held > coins && c > 0) {
+            c--;
+            held--;
+        }
+    }
+    std::shuffle(result.begin(), result.end(), rng);
+    return result;
+}
+
+// ---------------------------------------------------------
+// State digests (--digest=FILE, --compare-digests=A,B)
+//
+// The disk array is hashed as raw 64-bit words (x|y, vx|vy,
+// radius|coins per disk) through four independent xxHash64-style
+// lanes, so the loop has no serial dependency and vectorizes.
+// Float bit patterns are hashed, so any divergence shows up.
+// ---------------------------------------------------------
+static const uint64_t DIGEST_P1 = 0x9E3779B185EBCA87ull;
+static const uint64_t DIGEST_P2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t DIGEST_P3 = 0x165667B19E3779F9ull;
+static const uint64_t DIGEST_P4 = 0x85EBCA77C2B2AE63ull;
+
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t digest_round(uint64_t acc, uint64_t word) {
+    return rotl64(acc + word * DIGEST_P2, 31) * DIGEST_P1;
+}
+
+template <class Store>
+uint64_t state_digest(const Store &disks) {
+    using Element = typename Store::value_type;
+    static_assert(sizeof(Element) % 8 == 0, "digest reads whole 64-bit words per disk");
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(disks.data());
+    size_t words = disks.size() * (sizeof(Element) / 8);
+
+    uint64_t lane[4] = {DIGEST_P1 + DIGEST_P2, DIGEST_P2, 0, 0 - DIGEST_P1};
+    size_t w = 0;
+    for (; w + 4 <= words; w += 4) {
+        uint64_t block[4];
+        std::memcpy(block, bytes + w * 8, sizeof(block));
+        for (int l = 0; l < 4; l++) lane[l] = digest_round(lane[l], block[l]);
+    }
+    uint64_t h = rotl64(lane[0], 1) + rotl64(lane[1], 7) + rotl64(lane[2], 12) + rotl64(lane[3], 18);
+    for (int l = 0; l < 4; l++) {
+        h = (h ^ digest_round(0, lane[l])) * DIGEST_P1 + DIGEST_P4;
+    }
+    h += words * 8;
+    for (; w < words; w++) {
+        uint64_t tail;
+        std::memcpy(&tail, bytes + w * 8, sizeof(tail));
+        h = rotl64(h ^ digest_round(0, tail), 27) * DIGEST_P1 + DIGEST_P4;
+    }
+    h ^= h >> 33;
+    h *= DIGEST_P2;
+    h ^= h >> 29;
+    h *= DIGEST_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Reads "step hash" lines; '#' lines are comments
+static bool read_digests(const std::string &path,
+                         std::vector<std::pair<long long, uint64_t>> &out) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::stringstream ss(line);
+        long long step;
+        std::string hex;
+        if (!(ss >> step >> hex)) continue;
+        out.emplace_back(step, std::strtoull(hex.c_str(), nullptr, 16));
+    }
+    return true;
+}
+
+// Reports the first step where two digest streams differ
+int compare_digests(const std::string &spec) {
+    size_t comma = spec.find(',');
+    if (comma == std::string::npos) {
+        std::cerr << "--compare-digests expects A,B\n";
+        return 2;
+    }
+    std::string pathA = spec.substr(0, comma), pathB = spec.substr(comma + 1);
+    std::vector<std::pair<long long, uint64_t>> a, b;
+    if (!read_digests(pathA, a) || !read_digests(pathB, b)) {
+        std::cerr << "Failed to read digest files\n";
+        return 2;
+    }
+    size_t n = std::min(a.size(), b.size());
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i]) {
+            std::cout << "Diverged at step " << a[i].first << " (entry " << i << "): "
+                      << std::hex << a[i].second << " vs " << b[i].second << std::dec << "\n";
+            return 1;
+        }
+    }
+    if (a.size() != b.size()) {
+        std::cout << "Identical for " << n << " steps, then "
+                  << (a.size() > b.size() ? pathB : pathA) << " ends\n";
+        return 1;
+    }
+    std::cout << "Identical: " << n << " steps\n";
+    return 0;
+}
+
+// -------------------------------------------------------------
+// Out-of-core tiles (--tiles=DIR): a headless run whose compact
+// disks live in memory-mapped files, one per horizontal band of
+// broad-phase rows, with at most --resident-tiles mapped at once.
+//
+// Each step sweeps the bands top to bottom. Band b is copied into a
+// window together with its halo (the disks of band b+1 up to its
+// first row) and goes through the usual geometric pass for b's rows
+// only, so every pair is still visited once. Disks that left the
+// band then move to the band they are in now. A band's positions
+// are updated the first time the sweep needs it, as b's halo or as
+// b itself, so every disk moves once per step; disks that jump to a
+// band that is not mapped wait in a small per-band list.
+// -------------------------------------------------------------
+struct TileHeader {
+    uint64_t magic;
+    uint64_t count;      // disks in the tile
+    uint64_t capacity;   // disks the file has room for
+    uint64_t reserved;
+};
+static const uint64_t TILE_MAGIC = 0x31656c6954534944ull;  // "DISTile1"
+
+struct Tile {
+    std::string path;
+    TileHeader *header = nullptr;      // mapping, nullptr when not resident
+    size_t      mappedBytes = 0;
+    long long   lastUse = 0;
+    long long   updatedStep = -1;      // step whose positions it holds
+    TrackedVector<CompactDisk, MEM_DISKS> carry;    // arrived after this step's update
+    TrackedVector<CompactDisk, MEM_DISKS> arrived;  // arrived before it; moved already
+};
+
+struct TiledDomain {
+    std::string dir;
+    std::vector<Tile> tiles;
+    int       rowsPerTile = 1;
+    int       resident = 0;
+    int       pinLo = 0, pinHi = -1;   // tiles the sweep is holding mapped
+    long long clock = 0;
+    size_t    mappedBytes = 0, peakMappedBytes = 0;
+    CompactStore        window;        // band plus halo, collided in memory
+    std::vector<size_t> halo;          // window tail -> index in the next band
+};
+static TiledDomain g_tiles;
+
+// A mapped tile's disks as a store for the statistics templates
+struct TileSpan {
+    using value_type = CompactDisk;
+    const CompactDisk *ptr;
+    size_t n;
+    size_t size() const { return n; }
+    const CompactDisk &operator[](size_t i) const { return ptr[i]; }
+    const CompactDisk *begin() const { return ptr; }
+    const CompactDisk *end() const { return ptr + n; }
+};
+
+inline CompactDisk *tile_disks(Tile &t) {
+    return reinterpret_cast<CompactDisk *>(t.header + 1);
+}
+
+inline TileSpan tile_span(Tile &t) {
+    return TileSpan{tile_disks(t), (size_t)t.header->count};
+}
+
+inline int tile_row(int32_t y) {
+    const CellGrid &g = g_broadPhase;
+    return std::min(g.rows - 1, std::max(0, (int)(y * (1.f / COMPACT_POS_SCALE) / g.size)));
+}
+
+inline int tile_of(const TiledDomain &dom, int32_t y) {
+    return std::min((int)dom.tiles.size() - 1, tile_row(y) / dom.rowsPerTile);
+}
+
+// Map a tile's file with room for at least `capacity` disks
+static bool tile_map(TiledDomain &dom, Tile &t, size_t capacity) {
+#if defined(__linux__) || defined(__APPLE__)
+    int fd = open(t.path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    struct stat st;
+    size_t bytes = sizeof(TileHeader) + capacity * sizeof(CompactDisk);
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && (size_t)st.st_size < bytes) {
+        ok = ftruncate(fd, (off_t)bytes) == 0;
+    } else if (ok) {
+        bytes = (size_t)st.st_size;
+    }
+    void *p = ok ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    madvise(p, bytes, MADV_SEQUENTIAL);
+    t.header = static_cast<TileHeader *>(p);
+    t.mappedBytes = bytes;
+    if (t.header->magic != TILE_MAGIC) {
+        t.header->magic = TILE_MAGIC;
+        t.header->count = 0;
+    }
+    t.header->capacity = (bytes - sizeof(TileHeader)) / sizeof(CompactDisk);
+    dom.mappedBytes += bytes;
+    dom.peakMappedBytes = std::max(dom.peakMappedBytes, dom.mappedBytes);
+    return true;
+#else
+    (void)dom; (void)t; (void)capacity;
+    return false;
+#endif
+}
+
+static void tile_unmap(TiledDomain &dom, Tile &t) {
+#if defined(__linux__) || defined(__APPLE__)
+    munmap(t.header, t.mappedBytes);
+#endif
+    dom.mappedBytes -= t.mappedBytes;
+    t.header = nullptr;
+    t.mappedBytes = 0;
+}
+
+// Map tile i, unmapping the least recently used unpinned tiles to stay
+// within the budget
+static bool tile_acquire(TiledDomain &dom, int i) {
+    Tile &t = dom.tiles[i];
+    t.lastUse = ++dom.clock;
+    if (t.header) return true;
+    while (dom.resident >= g_residentTiles) {
+        int victim = -1;
+        for (int k = 0; k < (int)dom.tiles.size(); k++) {
+            if (!dom.tiles[k].header || (k >= dom.pinLo && k <= dom.pinHi)) continue;
+            if (victim < 0 || dom.tiles[k].lastUse < dom.tiles[victim].lastUse) victim = k;
+        }
+        if (victim < 0) break;
+        tile_unmap(dom, dom.tiles[victim]);
+        dom.resident--;
+    }
+    if (!tile_map(dom, t, 0)) return false;
+    dom.resident++;
+    return true;
+}
+
+// Append to a mapped tile, growing its file by doubling
+static bool tile_append(TiledDomain &dom, Tile &t, const CompactDisk *disks, size_t n) {
+    size_t count = t.header->count;
+    if (count + n > t.header->capacity) {
+        size_t capacity = std::max<size_t>(count + n, std::max<size_t>(4096, 2 * t.header->capacity));
+        tile_unmap(dom, t);
+        if (!tile_map(dom, t, capacity)) return false;
+    }
+    std::copy(disks, disks + n, tile_disks(t) + count);
+    t.header->count = count + n;
+    return true;
+}
+
+// A disk left band `from` during step `step`: straight into a
+// neighbouring band (mapped and already moved), otherwise into the
+// band's waiting list. Which bands happen to be mapped never matters,
+// so results do not depend on --resident-tiles.
+static bool tile_send(TiledDomain &dom, int from, int to, const CompactDisk &d, long long step) {
+    Tile &t = dom.tiles[to];
+    if (std::abs(to - from) == 1) return tile_append(dom, t, &d, 1);
+    (t.updatedStep == step ? t.carry : t.arrived).push_back(d);
+    return true;
+}
+
+// Bring tile i to step `step`: waiting disks from earlier steps join
+// before the position update, disks already moved this step after it
+static bool tile_update(TiledDomain &dom, int i, float dt, long long step) {
+    if (!tile_acquire(dom, i)) return false;
+    Tile &t = dom.tiles[i];
+    if (t.updatedStep == step) return true;
+    if (!tile_append(dom, t, t.carry.data(), t.carry.size())) return false;
+    t.carry.clear();
+    CompactDisk *disks = tile_disks(t);
+    parallel_for((size_t)t.header->count, PARALLEL_MIN_CHUNK, [&](size_t from, size_t to, int) {
+        for (size_t k = from; k < to; k++) update_position(disks[k], dt);
+    });
+    if (!tile_append(dom, t, t.arrived.data(), t.arrived.size())) return false;
+    t.arrived.clear();
+    t.updatedStep = step;
+    return true;
+}
+
+// Step `step` over every band; returns the collisions, or -1 if a tile
+// could not be mapped
+long long tiles_step(TiledDomain &dom, float dt, long long step, std::mt19937 &rng) {
+    TraceScope trace("physics");
+    const int tiles = (int)dom.tiles.size();
+    const int rows  = g_broadPhase.rows;
+    long long collisions = 0;
+    for (int b = 0; b < tiles; b++) {
+        dom.pinLo = std::max(0, b - 1);
+        dom.pinHi = std::min(tiles - 1, b + 1);
+        if (!tile_update(dom, b, dt, step)) return -1;
+        if (b + 1 < tiles && !tile_update(dom, b + 1, dt, step)) return -1;
+        int rowBegin = b * dom.rowsPerTile;
+        int rowEnd   = std::min(rows, rowBegin + dom.rowsPerTile);
+
+        // Window: band b, then band b+1's disks up to its first row
+        Tile &tile = dom.tiles[b];
+        size_t n = tile.header->count;
+        dom.window.resize(n);
+        std::copy(tile_disks(tile), tile_disks(tile) + n, dom.window.begin());
+        dom.halo.clear();
+        if (b + 1 < tiles) {
+            Tile &next = dom.tiles[b + 1];
+            const CompactDisk *nd = tile_disks(next);
+            for (size_t i = 0; i < next.header->count; i++) {
+                if (tile_row(nd[i].y) <= rowEnd) {
+                    dom.halo.push_back(i);
+                    dom.window.push_back(nd[i]);
+                }
+            }
+        }
+        collisions += collide_disks(dom.window, rng, rowBegin, rowEnd);
+        std::copy(dom.window.begin(), dom.window.begin() + n, tile_disks(tile));
+        if (b + 1 < tiles) {
+            CompactDisk *nd = tile_disks(dom.tiles[b + 1]);
+            for (size_t k = 0; k < dom.halo.size(); k++) nd[dom.halo[k]] = dom.window[n + k];
+        }
+
+        // Disks that left the band move out
+        CompactDisk *disks = tile_disks(tile);
+        for (size_t i = 0; i < n;) {
+            int to = tile_of(dom, disks[i].y);
+            if (to == b) {
+                i++;
+                continue;
+            }
+            CompactDisk leaving = disks[i];
+            disks[i] = disks[--n];
+            if (!tile_send(dom, b, to, leaving, step)) return -1;
+        }
+        tile.header->count = n;
+    }
+
+    // Bands passed before a far jump reached them take it now, so a
+    // sample sees every disk
+    dom.pinLo = 0;
+    dom.pinHi = -1;
+    for (int i = 0; i < tiles; i++) {
+        Tile &t = dom.tiles[i];
+        if (t.carry.empty()) continue;
+        if (!tile_acquire(dom, i) || !tile_append(dom, t, t.carry.data(), t.carry.size())) return -1;
+        t.carry.clear();
+    }
+    return collisions;
+}
+
+// One chart sample from a read-only sweep over the tiles, newest
+// mappings first
+bool tiles_sample(TiledDomain &dom) {
+    TraceScope trace("stats");
+    const int tiles = (int)dom.tiles.size();
+    if (plot_needs_ranges()) {
+        double e = 0.0;
+        size_t disks = 0;
+        for (int i = tiles - 1; i >= 0; i--) {
+            if (!tile_acquire(dom, i)) return false;
+            e += kinetic_energy(tile_span(dom.tiles[i]));
+            disks += dom.tiles[i].header->count;
+        }
+        plot_set_ranges(e / std::max<size_t>(1, disks));
+    }
+    PlotSample sample;
+    sample.gini = coin_gini();
+    for (int i = 0; i < tiles; i++) {
+        if (!tile_acquire(dom, i)) return false;
+        plot_accumulate(tile_span(dom.tiles[i]), sample);
+    }
+    plot_record(sample);
+    return true;
+}
+
+// Fresh tile files in dir; disks are dealt and placed as in
+// place_disks (or copied from `initial`), staged per band and written
+// in batches
+bool tiles_init(TiledDomain &dom, const std::string &dir, std::mt19937 &rng,
+                const CompactStore *initial = nullptr) {
+#if defined(__linux__) || defined(__APPLE__)
+    mkdir(dir.c_str(), 0755);
+#endif
+    broad_phase_init(0);                 // the grid only ever holds one window
+    g_rdf.disks = g_diskCount;
+    const int rows = g_broadPhase.rows;
+    dom = TiledDomain();
+    dom.dir = dir;
+    dom.rowsPerTile = (rows + std::min(g_tileCount, rows) - 1) / std::min(g_tileCount, rows);
+    dom.tiles.resize((rows + dom.rowsPerTile - 1) / dom.rowsPerTile);
+    for (size_t i = 0; i < dom.tiles.size(); i++) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/tile-%04zu.bin", i);
+        dom.tiles[i].path = dir + name;
+        std::remove(dom.tiles[i].path.c_str());
+    }
+
+    inequality_init(CompactStore());
+    const size_t STAGE = 65536;
+    std::vector<std::vector<CompactDisk>> staged(dom.tiles.size());
+    auto flush = [&](int t) {
+        bool ok = tile_acquire(dom, t) &&
+                  tile_append(dom, dom.tiles[t], staged[t].data(), staged[t].size());
+        staged[t].clear();
+        return ok;
+    };
+    auto stage = [&](const CompactDisk &c) {
+        inequality_insert(c.coin_count);
+        int t = tile_of(dom, c.y);
+        staged[t].push_back(c);
+        return staged[t].size() < STAGE || flush(t);
+    };
+    if (initial) {
+        for (const CompactDisk &c : *initial) {
+            if (!stage(c)) return false;
+        }
+    }
+    for (int i = 0, left = g_totalCoins; !initial && i < g_diskCount; i++) {
+        int coins = std::min(left, MAX_COINS_PER_DISK);    // as deal_coins
+        left -= coins;
+        CompactDisk c;
+        pack(make_disk(coins, rng), c);
+        if (!stage(c)) return false;
+    }
+    for (int t = 0; t < (int)dom.tiles.size(); t++) {
+        if (!flush(t)) return false;
+    }
+    return true;
+}
+
+// Unmap and delete the tile files
+void tiles_close(TiledDomain &dom) {
+    for (Tile &t : dom.tiles) {
+        if (t.header) tile_unmap(dom, t);
+        std::remove(t.path.c_str());
+    }
+    dom.resident = 0;
+}
+
+// Headless tiled run: --steps steps (or until --target-error), with a
+// chart sample every 0.1 s of simulated time
+int run_tiled(std::mt19937 &rng) {
+    if (!tiles_init(g_tiles, g_tileDir, rng)) {
+        std::cerr << "Failed to create tiles in " << g_tileDir << "\n";
+        tiles_close(g_tiles);
+        return 1;
+    }
+    float dt = g_fixedDt > 0.f ? g_fixedDt : 1.f / FPS;
+    long long sampleEvery = std::max(1L, std::lround(0.1f / dt));
+    int status = 0;
+    for (long long s = 0; s < g_steps; s++) {
+        TraceScope frameTrace("frame");
+        long long collisions = tiles_step(g_tiles, dt, step_count, rng);
+        if (collisions < 0) {
+            status = 1;
+            break;
+        }
+        collision_count += collisions;
+        step_count++;
+        if (step_count % sampleEvery == 0 && collision_count > 0) {
+            if (!tiles_sample(g_tiles)) {
+                status = 1;
+                break;
+            }
+            enforce_memory_budget();
+            if (g_targetError > 0.0 && errors_below(g_targetError, g_diskCount)) {
+                std::cout << "Target error reached after " << sample_count << " samples\n";
+                break;
+            }
+        }
+    }
+    if (status != 0) {
+        std::cerr << "Failed to map a tile in " << g_tileDir << "\n";
+    }
+    std::cout << "Tiled run: " << step_count << " steps, " << collision_count << " collisions, "
+              << sample_count << " samples, " << g_tiles.tiles.size() << " tiles, peak mapped "
+              << format_bytes((double)g_tiles.peakMappedBytes) << "\n";
+    tiles_close(g_tiles);
+    return status;
+}
+
+// ---------------------------------------------------------
+// Engine equivalence check (--check-engines=1)
+//
+// Every candidate engine (and the geometric engine on compact and on
+// tiled disks) is run against the reference all-pairs engine from the
+// same seeds: CHECK_REPLICAS independent runs per engine with matched
+// initial states and dynamics seeds. Burn-in and
+// snapshot spacing are set from the reference's collision rate so
+// every disk collides CHECK_BURN_IN_HITS / CHECK_SPACING_HITS times
+// in between, which keeps snapshots roughly independent. Each snapshot contributes one random disk's coin
+// count (chi-square homogeneity test) and the mean squared coin
+// count (two-sample KS test). Collision rates per step must agree
+// within CHECK_RATE_TOLERANCE. The coin rule's integer form is
+// checked against exchange_coins on random coin pairs.
+// ---------------------------------------------------------
+static const int    CHECK_REPLICAS       = 8;
+static const int    CHECK_CALIBRATION    = 500;    // reference steps to measure the rate
+static const double CHECK_BURN_IN_HITS   = 40.0;   // collisions per disk before sampling
+static const double CHECK_SPACING_HITS   = 10.0;   // collisions per disk between snapshots
+static const double CHECK_ALPHA          = 1e-3;
+static const double CHECK_RATE_TOLERANCE = 0.10;
+static const int    CHECK_SUBSTEPS       = 4;      // steps per frame: fewer grazing contacts missed
+
+// Regularized upper incomplete gamma Q(a, x)
+static double gamma_q(double a, double x) {
+    if (x <= 0.0) return 1.0;
+    double gln = std::lgamma(a);
+    if (x < a + 1.0) {
+        double sum = 1.0 / a, term = sum;
+        for (int n = 1; n < 500; n++) {
+            term *= x / (a + n);
+            sum  += term;
+            if (std::fabs(term) < std::fabs(sum) * 1e-15) break;
+        }
+        return 1.0 - sum * std::exp(-x + a * std::log(x) - gln);
+    }
+    // Lentz continued fraction
+    double b = x + 1.0 - a, c = 1e300, d = 1.0 / b, h = d;
+    for (int i = 1; i < 500; i++) {
+        double an = -i * (i - a);
+        b += 2.0;
+        d = an * d + b;
+        if (std::fabs(d) < 1e-300) d = 1e-300;
+        c = b + an / c;
+        if (std::fabs(c) < 1e-300) c = 1e-300;
+        d = 1.0 / d;
+        double delta = d * c;
+        h *= delta;
+        if (std::fabs(delta - 1.0) < 1e-15) break;
+    }
+    return std::exp(-x + a * std::log(x) - gln) * h;
+}
+
+// Chi-square homogeneity test of two histograms; returns the p-value
+static double chi_square_p(const std::vector<long long> &a, const std::vector<long long> &b,
+                           double *statistic) {
+    double na = 0, nb = 0;
+    for (size_t k = 0; k < a.size(); k++) { na += a[k]; nb += b[k]; }
+    double chi2 = 0.0;
+    int used = 0;
+    for (size_t k = 0; k < a.size(); k++) {
+        double col = (double)a[k] + b[k];
+        if (col == 0) continue;
+        used++;
+        double ea = col * na / (na + nb), eb = col * nb / (na + nb);
+        chi2 += (a[k] - ea) * (a[k] - ea) / ea + (b[k] - eb) * (b[k] - eb) / eb;
+    }
+    *statistic = chi2;
+    return used > 1 ? gamma_q(0.5 * (used - 1), 0.5 * chi2) : 1.0;
+}
+
+// Two-sample Kolmogorov-Smirnov test; returns the p-value
+static double ks_p(std::vector<double> a, std::vector<double> b, double *statistic) {
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    size_t i = 0, j = 0;
+    double d = 0.0;
+    while (i < a.size() && j < b.size()) {
+        double v = std::min(a[i], b[j]);
+        while (i < a.size() && a[i] <= v) i++;
+        while (j < b.size() && b[j] <= v) j++;
+        d = std::max(d, std::fabs((double)i / a.size() - (double)j / b.size()));
+    }
+    *statistic = d;
+    double ne = (double)a.size() * b.size() / (a.size() + b.size());
+    double lambda = (std::sqrt(ne) + 0.12 + 0.11 / std::sqrt(ne)) * d;
+    double p = 0.0;
+    for (int k = 1; k <= 100; k++) {
+        p += 2.0 * ((k % 2) ? 1.0 : -1.0) * std::exp(-2.0 * k * k * lambda * lambda);
+    }
+    return std::min(1.0, std::max(0.0, p));
+}
+
+struct EngineSample {
+    std::vector<long long> pickedCoins = std::vector<long long>(9, 0);
+    std::vector<double>    meanSquare;
+    long long collisions = 0;
+    long long steps      = 0;
+    bool      failed     = false;   // tiles could not be created or mapped
+};
+
+// Disk layout a candidate runs in; the collision engine is chosen separately
+enum class CheckStore { Plain, Compact, Tiled };
+
+// One replica once it is set up: `step` advances one step and returns
+// its collisions (-1 on failure), `coins` appends every disk's coins
+template <class Step, class Coins>
+static bool sample_replica(EngineSample &out, std::mt19937 &picker, int snapshots,
+                           int burnIn, int spacing, Step step, Coins coins) {
+    for (int s = 0; s < burnIn; s++) {
+        if (step() < 0) return false;
+    }
+    std::vector<int> held;
+    for (int k = 0; k < snapshots; k++) {
+        for (int s = 0; s < spacing; s++) {
+            long long c = step();
+            if (c < 0) return false;
+            out.collisions += c;
+            out.steps++;
+        }
+        held.clear();
+        if (!coins(held) || held.empty()) return false;
+        out.pickedCoins[held[picker() % held.size()]]++;
+        double m2 = 0.0;
+        for (int c : held) m2 += (double)c * c;
+        out.meanSquare.push_back(m2 / held.size());
+    }
+    return true;
+}
+
+// Scratch directory for a tiled replica, empty on failure
+static std::string check_scratch_dir() {
+#if defined(__linux__) || defined(__APPLE__)
+    const char *tmp = std::getenv("TMPDIR");
+    std::string path = std::string(tmp && *tmp ? tmp : "/tmp") + "/disk_sim-check-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    return mkdtemp(name.data()) ? std::string(name.data()) : std::string();
+#else
+    return std::string();
+#endif
+}
+
+static EngineSample run_engine(Engine engine, unsigned seed, int snapshotsPerReplica,
+                               int burnIn, int spacing, CheckStore store = CheckStore::Plain) {
+    EngineSample out;
+    const float dt = 1.f / (FPS * CHECK_SUBSTEPS);
+    for (int r = 0; r < CHECK_REPLICAS && !out.failed; r++) {
+        // Same initial state and dynamics seed for every engine
+        srand(seed + r);
+        std::mt19937 setup(seed + r);
+        std::vector<int> dealt = deal_coins(g_diskCount, g_totalCoins);
+        std::mt19937 rng(seed * 7919u + r);
+        std::mt19937 picker(seed + 104729u * (r + 1));
+
+        if (store == CheckStore::Plain) {
+            DiskStore disks = place_disks(dealt, setup);
+            engine_init(disks, engine);
+            sample_replica(out, picker, snapshotsPerReplica, burnIn, spacing,
+                           [&] { return physics_step(disks, dt, rng, engine); },
+                           [&](std::vector<int> &held) {
+                               for (auto &d : disks) held.push_back(d.coin_count);
+                               return true;
+                           });
+            continue;
+        }
+
+        // Compact and tiled runs use the geometric engine
+        CompactStore disks = place_disks<CompactStore>(dealt, setup);
+        if (store == CheckStore::Compact) {
+            engine_init(disks);
+            sample_replica(out, picker, snapshotsPerReplica, burnIn, spacing,
+                           [&] { return physics_step(disks, dt, rng); },
+                           [&](std::vector<int> &held) {
+                               for (auto &c : disks) held.push_back(c.coin_count);
+                               return true;
+                           });
+            continue;
+        }
+        TiledDomain dom;
+        std::string dir = check_scratch_dir();
+        long long step = 0;
+        out.failed = dir.empty() || !tiles_init(dom, dir, setup, &disks) ||
+            !sample_replica(out, picker, snapshotsPerReplica, burnIn, spacing,
+                            [&] { return tiles_step(dom, dt, step++, rng); },
+                            [&](std::vector<int> &held) {
+                                for (int i = 0; i < (int)dom.tiles.size(); i++) {
+                                    if (!tile_acquire(dom, i)) return false;
+                                    for (auto &c : tile_span(dom.tiles[i])) held.push_back(c.coin_count);
+                                }
+                                return true;
+                            });
+        tiles_close(dom);
+        if (!dir.empty()) rmdir(dir.c_str());
+    }
+    return out;
+}
+
+// Integer coin rule vs exchange_coins on the same random coin pairs
+static bool check_coin_rule(unsigned seed) {
+    std::mt19937 rng(seed), pick(seed + 1);
+    uint64_t bitsState = seed;
+    std::vector<long long> a(81, 0), b(81, 0);
+    for (int t = 0; t < 400000; t++) {
+        int c1 = pick() % 9, c2 = pick() % (9 - c1);   // keep c1 + c2 <= 8
+        int x1 = c1, x2 = c2, y1 = c1, y2 = c2;
+        exchange_coins(x1, x2, rng);
+        exchange_coins_bits(y1, y2, splitmix64(bitsState));
+        a[x1 * 9 + x2]++;
+        b[y1 * 9 + y2]++;
+    }
+    double chi2;
+    double p = chi_square_p(a, b, &chi2);
+    bool ok = p >= CHECK_ALPHA;
+    std::cout << std::left << std::setw(12) << "coin-bits"
+              << " chi2 " << std::setw(9) << std::setprecision(4) << chi2
+              << " p " << std::setw(9) << p << (ok ? " PASS" : " FAIL") << "\n";
+    return ok;
+}
+
+// The reference engine's picked coins against the exact law (chi-square
+// goodness of fit, bins pooled from the top until 5 are expected). Only
+// M <= MAX_COINS_PER_DISK has one: above that the clamp destroys coins.
+static bool check_exact_fit(const std::vector<long long> &picked) {
+    std::cout << std::left << std::setw(12) << "exact";
+    if (g_totalCoins > MAX_COINS_PER_DISK) {
+        std::cout << " skipped: over " << MAX_COINS_PER_DISK
+                  << " coins the exchange clamp destroys coins, no exact law\n";
+        return true;
+    }
+    double n = 0.0;
+    for (long long c : picked) n += (double)c;
+    double chi2 = 0.0, observed = 0.0, expected = 0.0;
+    int used = 0;
+    for (int k = MAX_COINS_PER_DISK; k >= 0; k--) {
+        observed += (double)picked[k];
+        expected += n * g_exactReference[k] / g_diskCount;
+        if (expected < 5.0 && k > 0) continue;
+        if (expected > 0.0) {
+            chi2 += (observed - expected) * (observed - expected) / expected;
+            used++;
+        }
+        observed = expected = 0.0;
+    }
+    double p = used > 1 ? gamma_q(0.5 * (used - 1), 0.5 * chi2) : 1.0;
+    bool ok = p >= CHECK_ALPHA;
+    std::cout << " chi2 " << std::setw(9) << std::setprecision(4) << chi2
+              << " p " << std::setw(9) << p << (ok ? " PASS" : " FAIL") << "\n";
+    return ok;
+}
+
+// Integrated autocorrelation time of `perReplica`-long runs laid end to
+// end, in samples (Sokal's window: stop once the lag reaches 5 tau).
+// Deviations are taken from the pooled mean, so replicas that settle
+// at different levels count as correlated, which is the safe side.
+static double check_tau(const std::vector<double> &x, int perReplica) {
+    int replicas = (int)x.size() / perReplica;
+    double mean = 0.0, var = 0.0;
+    for (double v : x) mean += v / x.size();
+    for (double v : x) var += (v - mean) * (v - mean) / x.size();
+    if (var <= 0.0) return 0.5;
+    double tau = 0.5;
+    for (int lag = 1; lag < perReplica && lag < 5 * tau; lag++) {
+        double c = 0.0;
+        for (int r = 0; r < replicas; r++) {
+            const double *s = &x[(size_t)r * perReplica];
+            for (int i = 0; i + lag < perReplica; i++) c += (s[i] - mean) * (s[i + lag] - mean);
+        }
+        tau += c / ((double)replicas * (perReplica - lag) * var);
+    }
+    return tau;
+}
+
+// Means over consecutive blocks of `block` samples within each replica
+static std::vector<double> block_means(const std::vector<double> &x, int perReplica, int block) {
+    std::vector<double> out;
+    for (size_t r = 0; r + perReplica <= x.size(); r += perReplica) {
+        for (int b = 0; b + block <= perReplica; b += block) {
+            double sum = 0.0;
+            for (int i = 0; i < block; i++) sum += x[r + b + i];
+            out.push_back(sum / block);
+        }
+    }
+    return out;
+}
+
+int check_engines(unsigned seed) {
+    int perReplica = std::max(1, g_checkSnapshots / CHECK_REPLICAS);
+
+    // Collisions per disk per step of the reference sets the time scales
+    EngineSample probe = run_engine(Engine::Reference, seed, 1, 0, CHECK_CALIBRATION * CHECK_SUBSTEPS);
+    double hitsPerStep = 2.0 * probe.collisions / probe.steps / g_diskCount;
+    if (hitsPerStep <= 0.0) {
+        std::cout << "Reference engine produced no collisions; nothing to compare\n";
+        return 1;
+    }
+    int burnIn  = (int)std::ceil(CHECK_BURN_IN_HITS / hitsPerStep);
+    int spacing = (int)std::ceil(CHECK_SPACING_HITS / hitsPerStep);
+
+    std::cout << "Engine check: " << g_diskCount << " disks, radius " << g_diskRadius
+              << ", " << g_totalCoins << " coins, " << CHECK_REPLICAS << " x "
+              << perReplica << " snapshots " << spacing << " steps apart after "
+              << burnIn << " steps, seed " << seed << "\n";
+
+    EngineSample ref = run_engine(Engine::Reference, seed, perReplica, burnIn, spacing);
+    double refRate = (double)ref.collisions / ref.steps;
+
+    // Snapshots of one replica are correlated; KS compares block means
+    // about two autocorrelation times long, which are close to independent
+    double tau = check_tau(ref.meanSquare, perReplica);
+    int block = std::min(perReplica, std::max(1, (int)std::ceil(2.0 * tau)));
+    std::vector<double> refBlocks = block_means(ref.meanSquare, perReplica, block);
+    std::cout << std::left << std::setw(12) << "reference"
+              << " rate " << refRate << " collisions/step, <c^2> tau " << std::setprecision(3)
+              << tau << " snapshots, KS on " << refBlocks.size() << " block means\n";
+
+    bool allOk = check_coin_rule(seed) && check_exact_fit(ref.pickedCoins);
+    const struct {
+        const char *name;
+        Engine      engine;
+        CheckStore  store;
+    } candidates[] = {
+        {"geometric", Engine::Geometric, CheckStore::Plain},
+        {"dsmc",      Engine::DSMC,      CheckStore::Plain},
+        {"compact",   Engine::Geometric, CheckStore::Compact},
+        {"tiled",     Engine::Geometric, CheckStore::Tiled}};
+    for (auto &cand : candidates) {
+        EngineSample c = run_engine(cand.engine, seed, perReplica, burnIn, spacing, cand.store);
+        if (c.failed) {
+            std::cout << std::left << std::setw(12) << cand.name << " could not run tiles FAIL\n";
+            allOk = false;
+            continue;
+        }
+        double chi2, ksD;
+        double pChi = chi_square_p(ref.pickedCoins, c.pickedCoins, &chi2);
+        double pKs  = ks_p(refBlocks, block_means(c.meanSquare, perReplica, block), &ksD);
+        double ratio = refRate > 0 ? ((double)c.collisions / c.steps) / refRate : 0.0;
+        bool ok = pChi >= CHECK_ALPHA && pKs >= CHECK_ALPHA
+               && std::fabs(ratio - 1.0) <= CHECK_RATE_TOLERANCE;
+        allOk = allOk && ok;
+        std::cout << std::left << std::setw(12) << cand.name
+                  << " chi2 " << std::setw(9) << std::setprecision(4) << chi2
+                  << " p " << std::setw(9) << pChi
+                  << " KS " << std::setw(9) << ksD
+                  << " p " << std::setw(9) << pKs
+                  << " rate ratio " << std::setw(7) << ratio
+                  << (ok ? " PASS" : " FAIL") << "\n";
+    }
+    return allOk ? 0 : 1;
+}
+
+// ---------------------------------------------------------
+// parse_args: "--name=value" options, false on bad input
+// ---------------------------------------------------------
+static bool option_value(const std::string &arg, const char *name, std::string &value) {
+    std::string prefix = std::string(name) + "=";
+    if (arg.rfind(prefix, 0) != 0) return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+static void print_usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --engine=reference|geometric|dsmc  collision engine (default geometric)\n"
+              << "  --disks=N                number of disks (default " << DISK_COUNT << ")\n"
+              << "  --radius=R               disk radius in px (default " << DISK_RADIUS << ")\n"
+              << "  --coins=M                total coins, dealt from disk 0 (default 8)\n"
+              << "  --dsmc-cell=PX           DSMC cell size (default 4 * radius)\n"
+              << "  --lattice=N              run an N-agent lattice gas alongside (default off)\n"
+              << "  --lattice-density=F      lattice occupancy fraction (default 0.25)\n"
+              << "  --graph=FILE             exchange coins along the edges of an edge list\n"
+              << "  --graph-batch=B          edges sampled per graph step (default 65536)\n"
+              << "  --window=S               equilibrated averaging window in samples (default 2048)\n"
+              << "  --export=FILE            write the averaged histogram as CSV on exit\n"
+              << "  --init=FILE              sample initial coins from a histogram CSV\n"
+              << "  --velocity-chart=1       open a window with the speed histogram\n"
+              << "  --rdf-range=PX           g(r) range and minimum grid cell (default 4 * radius)\n"
+              << "  --export-rdf=FILE        write g(r) as CSV on exit (geometric engine)\n"
+              << "  --target-error=E         stop once every fraction's standard error <= E\n"
+              << "  --print-reference=1      print the exact finite-N distribution and exit\n"
+              << "  --seed=S                 seed the random generators (default random)\n"
+              << "  --check-engines=1        compare engines against the reference and exit\n"
+              << "  --check-snapshots=N      snapshots per engine in the check (default 4000)\n"
+              << "  --fixed-dt=S             fixed physics step in seconds (default wall clock)\n"
+              << "  --digest=FILE            write a 64-bit state digest every step\n"
+              << "  --compare-digests=A,B    report the first step two digest files differ\n"
+              << "  --trace=FILE             write a Chrome trace of frame phases on exit\n"
+              << "  --mem-budget=MB          decimate the chart history above MB tracked bytes\n"
+              << "  --huge-pages=off|thp|explicit  huge pages for disk and grid arrays (default thp)\n"
+              << "  --threads=N              pool threads including main (default: CPUs allowed)\n"
+              << "  --pin-threads=1          pin pool threads to the allowed CPUs\n"
+              << "  --compact=1              store disks in 16 bytes (quantized, geometric engine)\n"
+              << "  --tiles=DIR              headless out-of-core run with disks in tile files in DIR\n"
+              << "  --tile-count=T           bands the domain is split into (default 16)\n"
+              << "  --resident-tiles=K       tiles mapped at once, at least 3 (default 4)\n"
+              << "  --steps=N                steps for a --tiles run (default 1000)\n"
+              << "  --io-uring=0             write output with a pwrite thread instead of io_uring\n"
+              << "  --shm=NAME               publish chart samples to shared memory NAME\n"
+              << "  --shm-disks=1            with --shm, also publish every frame's disks\n"
+              << "  --shm-read=NAME          print samples from another run's --shm=NAME as CSV\n"
+              << "  --serve=SOCKET           host headless runs controlled over a UNIX socket\n"
+              << "  --serve-dir=DIR          directory for the server's snapshot files\n"
+              << "  --cell-size=PX           broad-phase cell size (default the g(r) range)\n"
+              << "  --tune=1                 pick cell size and threads by timing at startup (cached)\n";
+}
+
+bool parse_args(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string v;
+        if (option_value(arg, "--engine", v)) {
+            if (v == "reference")       g_engine = Engine::Reference;
+            else if (v == "geometric")  g_engine = Engine::Geometric;
+            else if (v == "dsmc")       g_engine = Engine::DSMC;
+            else return false;
+        } else if (option_value(arg, "--disks", v)) {
+            g_diskCount = std::atoi(v.c_str());
+            if (g_diskCount < 1) return false;
+        } else if (option_value(arg, "--radius", v)) {
+            g_diskRadius = std::atoi(v.c_str());
+            if (g_diskRadius < 1 || 2 * g_diskRadius >= (int)CHART_TOP) return false;
+        } else if (option_value(arg, "--coins", v)) {
+            g_totalCoins = std::atoi(v.c_str());
+            if (g_totalCoins < 0) return false;
+        } else if (option_value(arg, "--dsmc-cell", v)) {
+            g_dsmcCell = (float)std::atof(v.c_str());
+            if (g_dsmcCell <= 0.f) return false;
+        } else if (option_value(arg, "--lattice", v)) {
+            g_latticeAgents = std::atoll(v.c_str());
+            if (g_latticeAgents < 0) return false;
+        } else if (option_value(arg, "--lattice-density", v)) {
+            g_latticeDensity = (float)std::atof(v.c_str());
+            if (g_latticeDensity <= 0.f || g_latticeDensity > 0.9f) return false;
+        } else if (option_value(arg, "--graph", v)) {
+            g_graphPath = v;
+        } else if (option_value(arg, "--graph-batch", v)) {
+            g_graphBatch = std::atoi(v.c_str());
+            if (g_graphBatch < 1) return false;
+        } else if (option_value(arg, "--window", v)) {
+            g_windowSamples = std::atoi(v.c_str());
+            if (g_windowSamples < MSER_BATCH * MSER_MIN_BATCHES) return false;
+        } else if (option_value(arg, "--export", v)) {
+            g_exportPath = v;
+        } else if (option_value(arg, "--init", v)) {
+            g_initPath = v;
+        } else if (option_value(arg, "--velocity-chart", v)) {
+            g_velocityChart = (v != "0");
+        } else if (option_value(arg, "--rdf-range", v)) {
+            g_rdfRange = (float)std::atof(v.c_str());
+            if (g_rdfRange <= 0.f) return false;
+        } else if (option_value(arg, "--export-rdf", v)) {
+            g_rdfExportPath = v;
+        } else if (option_value(arg, "--target-error", v)) {
+            g_targetError = std::atof(v.c_str());
+            if (g_targetError <= 0.0) return false;
+        } else if (option_value(arg, "--print-reference", v)) {
+            g_printReference = (v != "0");
+        } else if (option_value(arg, "--seed", v)) {
+            g_seed    = (unsigned)std::strtoul(v.c_str(), nullptr, 10);
+            g_seedSet = true;
+        } else if (option_value(arg, "--check-engines", v)) {
+            g_checkEngines = (v != "0");
+        } else if (option_value(arg, "--check-snapshots", v)) {
+            g_checkSnapshots = std::atoi(v.c_str());
+            if (g_checkSnapshots < CHECK_REPLICAS) return false;
+        } else if (option_value(arg, "--fixed-dt", v)) {
+            g_fixedDt = (float)std::atof(v.c_str());
+            if (g_fixedDt <= 0.f) return false;
+        } else if (option_value(arg, "--digest", v)) {
+            g_digestPath = v;
+        } else if (option_value(arg, "--compare-digests", v)) {
+            g_compareDigests = v;
+        } else if (option_value(arg, "--trace", v)) {
+            g_tracePath = v;
+        } else if (option_value(arg, "--mem-budget", v)) {
+            g_memBudget = std::atof(v.c_str()) * 1024.0 * 1024.0;
+            if (g_memBudget <= 0.0) return false;
+        } else if (option_value(arg, "--huge-pages", v)) {
+            if (v == "off")            g_hugePages = HugePages::Off;
+            else if (v == "thp")       g_hugePages = HugePages::Thp;
+            else if (v == "explicit")  g_hugePages = HugePages::Explicit;
+            else return false;
+        } else if (option_value(arg, "--threads", v)) {
+            g_threads = std::atoi(v.c_str());
+            if (g_threads < 1) return false;
+        } else if (option_value(arg, "--pin-threads", v)) {
+            g_pinThreads = (v != "0");
+        } else if (option_value(arg, "--compact", v)) {
+            g_compact = (v != "0");
+        } else if (option_value(arg, "--tiles", v)) {
+            g_tileDir = v;
+        } else if (option_value(arg, "--tile-count", v)) {
+            g_tileCount = std::atoi(v.c_str());
+            if (g_tileCount < 1) return false;
+        } else if (option_value(arg, "--resident-tiles", v)) {
+            g_residentTiles = std::atoi(v.c_str());
+            if (g_residentTiles < 3) return false;
+        } else if (option_value(arg, "--io-uring", v)) {
+            g_ioUring = (v != "0");
+        } else if (option_value(arg, "--shm", v)) {
+            g_shmName = v;
+            if (v.empty()) return false;
+        } else if (option_value(arg, "--shm-disks", v)) {
+            g_shmDisks = (v != "0");
+        } else if (option_value(arg, "--shm-read", v)) {
+            g_shmRead = v;
+            if (v.empty()) return false;
+        } else if (option_value(arg, "--serve", v)) {
+            g_servePath = v;
+            if (v.empty()) return false;
+        } else if (option_value(arg, "--serve-dir", v)) {
+            g_serveDir = v;
+            if (v.empty()) return false;
+        } else if (option_value(arg, "--cell-size", v)) {
+            g_cellSize = (float)std::atof(v.c_str());
+            if (g_cellSize <= 0.f) return false;
+        } else if (option_value(arg, "--tune", v)) {
+            g_tune = (v != "0");
+        } else if (option_value(arg, "--steps", v)) {
+            g_steps = std::atoll(v.c_str());
+            if (g_steps < 1) return false;
+        } else {
+            return false;
+        }
+    }
+    if (g_totalCoins > (long long)g_diskCount * MAX_COINS_PER_DISK) {
+        std::cerr << "Too many coins for " << g_diskCount << " disks\n";
+        return false;
+    }
+    if ((g_compact || !g_tileDir.empty()) && g_engine != Engine::Geometric) {
+        std::cerr << (g_compact ? "--compact" : "--tiles") << " needs the geometric engine\n";
+        return false;
+    }
+    if (!g_rdfExportPath.empty() && g_engine != Engine::Geometric) {
+        std::cerr << "--export-rdf needs the geometric engine\n";
+        return false;
+    }
+    if (!g_tileDir.empty() && !g_initPath.empty()) {
+        std::cerr << "--init is not supported with --tiles\n";
+        return false;
+    }
+    if (g_tune && (g_engine != Engine::Geometric || !g_tileDir.empty() || !g_servePath.empty())) {
+        std::cerr << "--tune needs the geometric engine with in-memory disks\n";
+        return false;
+    }
+    if (!g_serveDir.empty() && g_servePath.empty()) {
+        std::cerr << "--serve-dir needs --serve\n";
+        return false;
+    }
+    if (g_shmDisks && (g_shmName.empty() || !g_tileDir.empty())) {
+        std::cerr << "--shm-disks needs --shm and in-memory disks\n";
+        return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------
+// draw_velocity_window: speed histogram + fitted 2D
+// Maxwell-Boltzmann curve, with both temperature estimates
+// ----------------------------------------------------
+void draw_velocity_window(sf::RenderWindow &win) {
+    TraceScope trace("velocity window");
+    static TextSlots texts;
+    win.clear(sf::Color(30, 30, 30));
+    const VelocityStats &v = g_velocity;
+
+    {
+        sf::Text &label = slot_text(texts, 0, arena_printf("kT equipartition %.0f   kT fit %.0f",
+                                                           v.kTEquipartition, v.kTFit), 14);
+        label.setFillColor(sf::Color::White);
+        label.setPosition(sf::Vector2f(10.f, 10.f));
+        win.draw(label);
+    }
+    if (v.entries == 0) {
+        win.display();
+        return;
+    }
+
+    float left = 10.f, bottom = 290.f, width = 380.f, height = 240.f;
+    double binWidth = v.speedMax / VELOCITY_BINS;
+    auto density = [&](int b) { return v.speed[b] / (v.entries * binWidth); };
+    double kT = v.kTFit > 0 ? v.kTFit : v.kTEquipartition;
+    double peak = std::sqrt(kT) > 0 ? std::exp(-0.5) / std::sqrt(kT) : 0.0;  // f at v = sqrt(kT)
+    for (int b = 0; b < VELOCITY_BINS; b++) peak = std::max(peak, density(b));
+    float barW = width / VELOCITY_BINS;
+
+    ArenaVector<sf::Vertex> bars;
+    bars.reserve(6 * VELOCITY_BINS);
+    for (int b = 0; b < VELOCITY_BINS; b++) {
+        float h = (float)(density(b) / peak) * height;
+        push_rect(bars, left + b * barW, bottom - h, barW - 1.f, h, sf::Color(0, 128, 255));
+    }
+    win.draw(bars.data(), bars.size(), sf::PrimitiveType::Triangles);
+
+    ArenaVector<sf::Vertex> curve;
+    curve.reserve(201);
+    for (int i = 0; i <= 200 && kT > 0; i++) {
+        double speed = v.speedMax * i / 200.0;
+        double f = speed / kT * std::exp(-speed * speed / (2.0 * kT));
+        sf::Vertex vert;
+        vert.position = sf::Vector2f(left + (float)(speed / v.speedMax) * width,
+                                     bottom - (float)(f / peak) * height);
+        vert.color = sf::Color::Yellow;
+        curve.push_back(vert);
+    }
+    win.draw(curve.data(), curve.size(), sf::PrimitiveType::LineStrip);
+    win.display();
+}
+
+// -------------------------------------------------------------
+// Startup tuning (--tune=1)
+//
+// Times the geometric step on a copy of the initial disks for a few
+// broad-phase cell sizes, then for a few pool sizes at the best cell,
+// and keeps the fastest pair. Results are cached per machine and
+// configuration in $XDG_CACHE_HOME/disk_sim/tuning (~/.cache by
+// default), so later runs skip the measurement. An explicit
+// --cell-size or --threads is kept and only the other is tuned.
+//
+// The copy steps with a copy of the rng, so the run itself is not
+// advanced, but the chosen cell size sets the row rngs of the pass:
+// tuned runs match untuned ones in distribution, not digest.
+// -------------------------------------------------------------
+static const int    TUNE_VERSION   = 1;
+static const double TUNE_SECONDS   = 0.03;   // timed steps per candidate, at least
+static const int    TUNE_MAX_STEPS = 64;
+
+struct TuneChoice {
+    float  cell    = 0.f;
+    int    threads = 0;
+    double seconds = 0.0;   // per step
+};
+
+static std::string tune_cache_path() {
+    const char *xdg  = std::getenv("XDG_CACHE_HOME");
+    const char *home = std::getenv("HOME");
+    if (xdg && *xdg) return std::string(xdg) + "/disk_sim/tuning";
+    if (home && *home) return std::string(home) + "/.cache/disk_sim/tuning";
+    return std::string();
+}
 
-        // Standard coin exchange (50% chance for each coin)
-        int coins_to_d2 = 0;
-        for (int i = 0; i < total_coins_d1; i++) {
-            if (dist01(rng) < 0.5f) {
-                coins_to_d2++;
+// Machine and configuration, hashed (FNV-1a) into the cache key
+template <class Store>
+static std::string tune_key(const Store &disks) {
+    std::ostringstream key;
+    key << "v" << TUNE_VERSION << " cpus=" << available_cpus();
+    if (std::ifstream cpuinfo{"/proc/cpuinfo"}) {
+        std::string line;
+        while (std::getline(cpuinfo, line)) {
+            if (line.compare(0, 10, "model name") == 0) {
+                key << " " << line;
+                break;
             }
         }
-        // Ensure we only subtract up to the number of coins available
-        coins_to_d2 = std::min(coins_to_d2, d1.coin_count);
-        d1.coin_count -= coins_to_d2;
-        d2.coin_count += coins_to_d2;
+    }
+#if defined(__linux__) || defined(__APPLE__)
+    char host[256] = {0};
+    if (gethostname(host, sizeof host - 1) == 0) key << " host=" << host;
+#endif
+    key << " disk=" << sizeof(disks[0]) << " n=" << disks.size() << " r=" << g_diskRadius
+        << " coins=" << g_totalCoins << " cell=" << g_cellSize << " threads=" << g_threads
+        << " pin=" << g_pinThreads
+        << " rdf=" << (g_rdfExportPath.empty() ? 0.f : g_rdfRange > 0.f ? g_rdfRange : 4.f * g_diskRadius);
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : key.str()) h = (h ^ c) * 0x100000001b3ull;
+    std::ostringstream hex;
+    hex << std::hex << std::setw(16) << std::setfill('0') << h;
+    return hex.str();
+}
 
-        int coins_to_d1 = 0;
-        for (int i = 0; i < total_coins_d2; i++) {
-            if (dist01(rng) < 0.5f) {
-                coins_to_d1++;
-            }
-        }
-        // Ensure we only subtract up to the number of coins available
-        coins_to_d1 = std::min(coins_to_d1, d2.coin_count);
-        d2.coin_count -= coins_to_d1;
-        d1.coin_count += coins_to_d1;
+static bool tune_cache_find(const std::string &path, const std::string &key, TuneChoice &out) {
+    std::ifstream in(path);
+    std::string k;
+    TuneChoice c;
+    while (in >> k >> c.cell >> c.threads >> c.seconds) {
+        if (k == key) out = c;   // the last entry for a key wins
+    }
+    return out.threads > 0;
+}
 
-        // Clamp
-        if (d1.coin_count > MAX_COINS_PER_DISK) d1.coin_count = MAX_COINS_PER_DISK;
-        if (d2.coin_count > MAX_COINS_PER_DISK) d2.coin_count = MAX_COINS_PER_DISK;
+static void tune_cache_add(const std::string &path, const std::string &key, const TuneChoice &c) {
+#if defined(__linux__) || defined(__APPLE__)
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        mkdir(path.substr(0, slash).c_str(), 0755);   // EEXIST is fine
+    }
+#endif
+    std::ofstream out(path, std::ios::app);
+    out << key << " " << c.cell << " " << c.threads << " " << c.seconds << "\n";
+}
 
-        // Overlap fix
-        float overlap = (d1.radius + d2.radius) - dist;
-        if (overlap > 0.f) {
-            float half = overlap * 0.5f;
-            d1.x -= nx * half;
-            d1.y -= ny * half;
-            d2.x += nx * half;
-            d2.y += ny * half;
-        }
+static void tune_pool(int threads) {
+    if (pool_size() == threads && !g_pool.queues.empty()) return;
+    pool_stop();
+    pool_start(threads, g_pinThreads);
+}
 
-        return true;
+// Seconds per step for the current cell size and pool
+template <class Store>
+static double tune_measure(const Store &initial, const std::mt19937 &rng) {
+    Store disks = initial;
+    std::mt19937 probe = rng;
+    const float dt = g_fixedDt > 0.f ? g_fixedDt : 1.f / FPS;
+    engine_init(disks);
+    physics_step(disks, dt, probe);   // first touch of the grid and the copy
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    int steps = 0;
+    while (steps < TUNE_MAX_STEPS && elapsed < TUNE_SECONDS) {
+        physics_step(disks, dt, probe);
+        steps++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
     }
-    return false;
+    return elapsed / steps;
 }
 
-// ------------------------------------
-// update_position: uses g_speedFactor
-// ------------------------------------
-void update_position(Disk &disk, float dt) {
-    // Multiply velocities by dt * g_speedFactor
-    disk.x += disk.vx * dt * g_speedFactor;
-    disk.y += disk.vy * dt * g_speedFactor;
+template <class Store>
+void tune_startup(const Store &disks, const std::mt19937 &rng) {
+    std::string path = tune_cache_path();
+    std::string key  = tune_key(disks);
+    TuneChoice best;
+    if (!path.empty() && tune_cache_find(path, key, best)) {
+        g_cellSize = best.cell;
+        tune_pool(best.threads);
+        std::cout << "Tuning (cached): cell " << best.cell << " px, " << best.threads
+                  << " threads\n";
+        return;
+    }
 
-    // bounce off left/right
-    if (disk.x - disk.radius < 0) {
-        disk.x = disk.radius;
-        disk.vx = -disk.vx;
-    } else if (disk.x + disk.radius > WIDTH) {
-        disk.x = WIDTH - disk.radius;
-        disk.vx = -disk.vx;
+    // Cells from one diameter up; g(r) exports keep the full range
+    float diameter = 2.f * g_diskRadius;
+    float minCell  = diameter;
+    if (!g_rdfExportPath.empty()) minCell = g_rdfRange > 0.f ? g_rdfRange : 4.f * g_diskRadius;
+    std::vector<float> cells;
+    if (g_cellSize > 0.f) {
+        cells.push_back(g_cellSize);
+    } else {
+        for (float m : {1.f, 1.5f, 2.f, 3.f, 4.f}) {
+            if (m * diameter >= minCell && m * diameter < CHART_TOP) cells.push_back(m * diameter);
+        }
+        if (cells.empty()) cells.push_back(minCell);
+    }
+    std::vector<int> threads;
+    int cpus = g_threads > 0 ? g_threads : available_cpus();
+    if (g_threads > 0) {
+        threads.push_back(g_threads);
+    } else {
+        for (int t = 1; t < cpus; t *= 2) threads.push_back(t);
+        threads.push_back(cpus);
     }
 
-    // bounce off top/bottom (we treat CHART_TOP as bottom)
-    if (disk.y - disk.radius < 0) {
-        disk.y = disk.radius;
-        disk.vy = -disk.vy;
-    } else if (disk.y + disk.radius > CHART_TOP) {
-        disk.y = CHART_TOP - disk.radius;
-        disk.vy = -disk.vy;
+    best.threads = threads.back();
+    best.seconds = 1e30;
+    tune_pool(best.threads);
+    for (float cell : cells) {
+        g_cellSize = cell;
+        double s = tune_measure(disks, rng);
+        if (s < best.seconds) { best.seconds = s; best.cell = cell; }
     }
+    g_cellSize = best.cell;
+    for (int t : threads) {
+        if (t == best.threads) continue;
+        tune_pool(t);
+        double s = tune_measure(disks, rng);
+        if (s < best.seconds) { best.seconds = s; best.threads = t; }
+    }
+    tune_pool(best.threads);
+    std::cout << "Tuning: cell " << best.cell << " px, " << best.threads << " threads, "
+              << std::setprecision(3) << best.seconds * 1e3 << " ms/step ("
+              << cells.size() + threads.size() - 1 << " candidates)\n" << std::setprecision(6);
+    if (!path.empty()) tune_cache_add(path, key, best);
 }
 
 // -------------------------------------------------------------
-// update_plot: record fraction of disks with 0..8 coins
-// also store them in g_coinFraction
+// Simulation server (--serve=SOCKET)
+//
+// One process hosts many small headless runs behind a UNIX socket,
+// so each run skips the process, window and font startup. Clients
+// send one command per line and get one line back, "ok ..." or
+// "error ...":
+//
+//   create [disks=N] [radius=R] [coins=M] [seed=S] [dt=S] [speed=F]
+//                          -> ok ID          (created paused)
+//   step ID N              run N more steps
+//   run ID                 run until paused
+//   pause ID
+//   speed ID F             set the run's speed factor
+//   histogram ID           current counts and the mean over samples
+//   snapshot ID FILE       write the disks as CSV to FILE in --serve-dir
+//   destroy ID
+//   list
+//   shutdown
+//
+// Runs take turns on the shared pool, each slice worth about
+// SERVER_QUANTUM disk-steps (deficit round robin), so a large run
+// cannot starve small ones and commands are answered between
+// slices. Runs keep compact disks and a nine-bin histogram; the
+// broad-phase grid and the coin trackers are shared scratch, and the
+// run's radius and speed factor are installed before each slice.
 // -------------------------------------------------------------
-void update_plot(const std::vector<Disk> &disks) {
-    // how many disks have each coin count
-    std::vector<int> counts(9, 0);
-    for (auto &d : disks) {
-        counts[d.coin_count]++;
-    }
+static const long long SERVER_QUANTUM = 1 << 21;   // disk-steps per slice
+static const size_t SERVER_OUTPUT_LIMIT = 1 << 20;  // unsent reply bytes before a client is dropped
 
-    // update global cumulative_counts
-    for (int i = 0; i < 9; i++) {
-        cumulative_counts[i] += counts[i];
-    }
+struct ServerRun {
+    int          id = 0;
+    CompactStore disks;
+    std::mt19937 rng;
+    int       radius  = DISK_RADIUS;
+    float     speed   = 5.f;         // speed factor, as g_speedFactor
+    float     dt      = 1.f / FPS;
+    long long sampleEvery = 6;       // steps per histogram sample (0.1 s)
+    long long pending = 0;           // steps left to run, -1 = until paused
+    long long deficit = 0;           // disk-steps this run may still spend
+    long long steps      = 0;
+    long long collisions = 0;
+    long long samples    = 0;
+    long long cumulative[9] = {0};   // disks per coin count, summed over samples
+};
 
-    // push back fraction
-    for (int i = 0; i < 9; i++) {
-        xdata[i].push_back(static_cast<float>(collision_count));
+struct ServerClient {
+    int         fd = -1;
+    std::string input;               // bytes received, up to the next newline
+    std::string output;              // replies the socket has not taken yet
+};
 
-        float avgNum = 0.f;
-        if (collision_count > 0) {
-            // average number of disks = (total count of i-coins) / number_of_collisions
-            avgNum = static_cast<float>(cumulative_counts[i]) / collision_count;
-        }
-        ydata[i].push_back(avgNum);
-        g_coinFraction[i] = avgNum;
-    }
-}
+struct SimServer {
+    std::vector<std::unique_ptr<ServerRun>> runs;
+    std::vector<ServerClient> clients;
+    int    nextId      = 1;
+    size_t cursor      = 0;          // next run to get a slice
+    int    gridRadius  = 0;          // radius the shared grid is set up for
+    bool   stopping    = false;
+};
+static SimServer g_server;
 
-// ---------------------------------------------
-// draw_line_graph: bottom 200px, range 0..0.5
-// with tick marks 0.0..0.5
-// ---------------------------------------------
-void draw_line_graph(sf::RenderWindow &window) {
-    if (collision_count < 1) {
-        return; // no data yet
+static ServerRun *server_find(const std::string &id) {
+    int n = std::atoi(id.c_str());
+    for (auto &run : g_server.runs) {
+        if (run->id == n) return run.get();
     }
+    return nullptr;
+}
 
-    float chartX     = 0.f;
-    float chartY     = CHART_TOP;
-    float chartWidth = (float)WIDTH;
-    float chartHt    = CHART_HEIGHT;
-
-    // X-axis
-    sf::RectangleShape xAxis(sf::Vector2f(chartWidth, 1.f));
-    xAxis.setPosition(sf::Vector2f(chartX, chartY + chartHt - 1.f));
-    xAxis.setFillColor(sf::Color::White);
-    window.draw(xAxis);
-
-    // Y-axis
-    sf::RectangleShape yAxis(sf::Vector2f(1.f, chartHt));
-    yAxis.setPosition(sf::Vector2f(chartX, chartY));
-    yAxis.setFillColor(sf::Color::White);
-    window.draw(yAxis);
+static void server_counts(const ServerRun &run, long long counts[9]) {
+    for (int k = 0; k < 9; k++) counts[k] = 0;
+    for (const CompactDisk &c : run.disks) counts[std::min<int>(c.coin_count, 8)]++;
+}
 
-    // Change to range 0..6:
-    auto scaleY = [&](float val) {
-        if (val > 6.f) val = 6.f;
-        float proportion = val / 6.f; // 0..1
-        return chartY + chartHt - (proportion * chartHt);
-    };
+static std::string server_create(std::istringstream &args) {
+    int disks = g_diskCount, radius = g_diskRadius, coins = g_totalCoins;
+    unsigned seed = g_seed + (unsigned)g_server.nextId;
+    float dt = g_fixedDt > 0.f ? g_fixedDt : 1.f / FPS, speed = g_speedFactor;
+    std::string arg;
+    while (args >> arg) {
+        size_t eq = arg.find('=');
+        std::string key = arg.substr(0, eq), v = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (key == "disks")       disks  = std::atoi(v.c_str());
+        else if (key == "radius") radius = std::atoi(v.c_str());
+        else if (key == "coins")  coins  = std::atoi(v.c_str());
+        else if (key == "seed")   seed   = (unsigned)std::strtoul(v.c_str(), nullptr, 10);
+        else if (key == "dt")     dt     = (float)std::atof(v.c_str());
+        else if (key == "speed")  speed  = (float)std::atof(v.c_str());
+        else return "error unknown setting " + key;
+    }
+    if (disks < 1 || radius < 1 || 2 * radius >= (int)CHART_TOP || coins < 0 ||
+        coins > (long long)disks * MAX_COINS_PER_DISK || dt <= 0.f || speed <= 0.f) {
+        return "error bad settings";
+    }
 
+    auto run = std::make_unique<ServerRun>();
+    run->id     = g_server.nextId++;
+    run->radius = radius;
+    run->speed  = speed;
+    run->dt     = dt;
+    run->sampleEvery = std::max(1L, std::lround(0.1f / dt));
+    run->rng.seed(seed);
+    srand(seed);                     // make_disk places disks with rand()
+    int savedRadius = g_diskRadius;
+    g_diskRadius = radius;
+    run->disks = place_disks<CompactStore>(deal_coins(disks, coins), run->rng);
+    g_diskRadius = savedRadius;
+    g_server.runs.push_back(std::move(run));
+    return "ok " + std::to_string(g_server.runs.back()->id);
+}
 
-    // Tick marks at integer steps 0..6:
-    for (int val = 0; val <= 6; val++) {
-        float yPos = scaleY(static_cast<float>(val));
+// Clients name a file, never a path: snapshots stay inside --serve-dir
+static bool server_snapshot_name_ok(const std::string &name) {
+    return !name.empty() && name != "." && name != ".." &&
+           name.find('/') == std::string::npos && name.find('\0') == std::string::npos;
+}
 
-        // short tick line
-        sf::RectangleShape tick(sf::Vector2f(5.f, 1.f));
-        tick.setFillColor(sf::Color::White);
-        tick.setPosition(sf::Vector2f(chartX - 2.f, yPos));
-        window.draw(tick);
-
-        // label: use fixed decimal (1 digit or so)
-        std::stringstream ss;
-        ss << std::fixed << std::setprecision(1) << val;
-        sf::Text label(g_font, ss.str(), 12);
-
-        auto lb = label.getLocalBounds();
-        label.setOrigin(sf::Vector2f(lb.size.x, lb.size.y * 0.5f));
-        label.setPosition(sf::Vector2f(chartX + 8.f, yPos));
-        label.setFillColor(sf::Color::White);
-        window.draw(label);
+static bool server_snapshot(const ServerRun &run, const std::string &path) {
+    AsyncOfstream out(path);
+    if (!out) return false;
+    out << "# disk_sim server run " << run.id << " step=" << run.steps << "\n"
+        << "x,y,vx,vy,radius,coins\n";
+    for (const CompactDisk &c : run.disks) {
+        Disk d = unpack(c);
+        out << d.x << "," << d.y << "," << d.vx << "," << d.vy << ","
+            << d.radius << "," << d.coin_count << "\n";
     }
+    return out.close();
+}
 
-    // scaleX (0..collision_count => 0..chartWidth)
-    auto scaleX = [&](float xVal) {
-        if (collision_count == 0) return chartX;
-        return chartX + (xVal / (float)collision_count) * chartWidth;
-    };
-
-    // 9 lines (0..8 coin counts)
-    sf::Color colors[9] = {
-        sf::Color::Blue, sf::Color::Red, sf::Color::Green,
-        sf::Color::Cyan, sf::Color::Magenta, sf::Color::Yellow,
-        sf::Color::White, sf::Color(128,128,128), sf::Color(255,127,0)
+static std::string server_command(const std::string &line) {
+    std::istringstream in(line);
+    std::string cmd, id;
+    in >> cmd;
+    if (cmd == "create") return server_create(in);
+    if (cmd == "list") {
+        std::ostringstream out;
+        out << "ok " << g_server.runs.size();
+        for (auto &run : g_server.runs) {
+            out << " " << run->id << ":" << run->disks.size() << ":" << run->steps
+                << (run->pending != 0 ? ":running" : ":paused");
+        }
+        return out.str();
+    }
+    if (cmd == "shutdown") {
+        g_server.stopping = true;
+        return "ok";
+    }
+    if (cmd.empty()) return "error empty command";
+    static const char *const RUN_COMMANDS[] = {
+        "step", "run", "pause", "speed", "histogram", "snapshot", "destroy"
     };
+    if (std::find(std::begin(RUN_COMMANDS), std::end(RUN_COMMANDS), cmd) == std::end(RUN_COMMANDS)) {
+        return "error unknown command " + cmd;
+    }
 
-    for (int i = 0; i < 9; i++) {
-        sf::VertexArray lineStrip(sf::PrimitiveType::LineStrip);
-        for (size_t k = 0; k < xdata[i].size(); k++) {
-            float px = scaleX(xdata[i][k]);
-            float py = scaleY(ydata[i][k]);
-
-            sf::Vertex v;
-            v.position = sf::Vector2f(px, py);
-            v.color    = colors[i];
-            lineStrip.append(v);
+    in >> id;
+    ServerRun *run = server_find(id);
+    if (!run) return "error no run " + id;
+    if (cmd == "step") {
+        long long n = 0;
+        if (!(in >> n) || n < 1) return "error bad step count";
+        run->pending = run->pending < 0 ? n : run->pending + n;
+        return "ok";
+    }
+    if (cmd == "run")   { run->pending = -1; return "ok"; }
+    if (cmd == "pause") { run->pending = 0;  run->deficit = 0; return "ok"; }
+    if (cmd == "speed") {
+        float f = 0.f;
+        if (!(in >> f) || f <= 0.f) return "error bad speed factor";
+        run->speed = f;
+        return "ok";
+    }
+    if (cmd == "histogram") {
+        long long counts[9];
+        server_counts(*run, counts);
+        std::ostringstream out;
+        out << "ok step=" << run->steps << " collisions=" << run->collisions
+            << " samples=" << run->samples << " counts=";
+        for (int k = 0; k < 9; k++) out << (k ? "," : "") << counts[k];
+        out << " mean=";
+        for (int k = 0; k < 9; k++) {
+            out << (k ? "," : "") << (run->samples ? (double)run->cumulative[k] / run->samples : 0.0);
         }
-        window.draw(lineStrip);
+        return out.str();
+    }
+    if (cmd == "snapshot") {
+        std::string name;
+        if (!(in >> name)) return "error missing file";
+        if (g_serveDir.empty()) return "error snapshots need --serve-dir";
+        if (!server_snapshot_name_ok(name)) return "error bad file name " + name;
+        return server_snapshot(*run, g_serveDir + "/" + name) ? "ok" : "error failed to write " + name;
+    }
+    if (cmd == "destroy") {
+        auto &runs = g_server.runs;
+        runs.erase(std::remove_if(runs.begin(), runs.end(),
+                                  [&](const std::unique_ptr<ServerRun> &r) { return r.get() == run; }),
+                   runs.end());
+        return "ok";
     }
+    return "error unknown command " + cmd;
 }
 
-// ----------------------------------------------------
-// draw_stats_window: show the 9 fractions with 3 decimals
-// ----------------------------------------------------
-void draw_stats_window(sf::RenderWindow &stats) {
-    // Just clear to dark grey
-    stats.clear(sf::Color(50, 50, 50));
+// One slice of the next run that has steps to take
+static void server_slice() {
+    auto &runs = g_server.runs;
+    for (size_t tried = 0; tried < runs.size(); tried++) {
+        if (g_server.cursor >= runs.size()) g_server.cursor = 0;
+        ServerRun &run = *runs[g_server.cursor++];
+        if (run.pending == 0) continue;
 
-    // Title
-    {
-        sf::Text title(g_font, "Coin Fractions", 18);
-        title.setFillColor(sf::Color::White);
-        auto tb = title.getLocalBounds();
-        title.setPosition(sf::Vector2f(10.f, 10.f));
-        stats.draw(title);
+        // Install the run's settings into the shared engine state
+        g_speedFactor = run.speed;
+        g_diskRadius  = run.radius;
+        if (g_server.gridRadius != run.radius) {
+            engine_init(run.disks);
+            g_server.gridRadius = run.radius;
+        }
+        long long cost = (long long)run.disks.size();
+        run.deficit = std::min(run.deficit + SERVER_QUANTUM, std::max(SERVER_QUANTUM, cost));
+        while (run.deficit >= cost && run.pending != 0) {
+            run.collisions += physics_step(run.disks, run.dt, run.rng);
+            run.steps++;
+            run.deficit -= cost;
+            if (run.pending > 0) run.pending--;
+            if (run.steps % run.sampleEvery == 0) {
+                long long counts[9];
+                server_counts(run, counts);
+                for (int k = 0; k < 9; k++) run.cumulative[k] += counts[k];
+                run.samples++;
+            }
+        }
+        if (run.pending == 0) run.deficit = 0;
+        return;
     }
+}
 
-    // Now show total collisions:
-    {
-        sf::Text collisionsText(g_font, "Collisions: " + std::to_string(collision_count), 16);
-        collisionsText.setFillColor(sf::Color::White);
-        collisionsText.setPosition(sf::Vector2f(10.f, 35.f));
-        stats.draw(collisionsText);
+static bool server_busy() {
+    for (auto &run : g_server.runs) {
+        if (run->pending != 0) return true;
     }
-    // For each coin count 0..8, show fraction w/ 3 decimals
-    float yOffset = 60.f;
-
-    for (int c = 0; c < 9; c++) {
-        std::stringstream ss;
-        ss << c << " coins = "
-           << std::fixed << std::setprecision(2) << g_coinFraction[c];
-
-        sf::Text line(g_font, ss.str(), 14);
-        line.setFillColor(sf::Color::White);
-        line.setPosition(sf::Vector2f(10.f, yOffset));
-        yOffset += 25.f;
+    return false;
+}
 
-        stats.draw(line);
+#if defined(__linux__) || defined(__APPLE__)
+// Writes as much of the client's queued replies as the socket takes
+// without blocking; false if the client is gone
+static bool server_flush(ServerClient &client) {
+    size_t off = 0;
+    while (off < client.output.size()) {
+        ssize_t w = write(client.fd, client.output.data() + off, client.output.size() - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (w <= 0) return false;
+        off += (size_t)w;
     }
+    client.output.erase(0, off);
+    return true;
+}
 
-    stats.display();
+static void server_drop(ServerClient &client) {
+    close(client.fd);
+    client.fd = -1;
 }
 
-int main() {
-    // Setup random
-    std::random_device rd;
-    std::mt19937 rng(rd());
-    std::uniform_real_distribution<float> velDist(-200.f, 200.f);
+// Accept clients and answer every complete line; blocks only when no
+// run has steps to take. Client sockets are non-blocking, so a client
+// that stops reading only grows its own queue, and is dropped once that
+// passes SERVER_OUTPUT_LIMIT.
+static void server_poll(int listener) {
+    std::vector<pollfd> fds{{listener, POLLIN, 0}};
+    for (auto &c : g_server.clients) {
+        fds.push_back({c.fd, (short)(POLLIN | (c.output.empty() ? 0 : POLLOUT)), 0});
+    }
+    if (poll(fds.data(), fds.size(), server_busy() ? 0 : -1) <= 0) return;
 
-    // Load our global font
-    if (!g_font.openFromFile("/System/Library/Fonts/SFNSMono.ttf")) {
-        std::cerr << "Failed to open font. Check path!\n";
+    for (size_t i = 1; i < fds.size(); i++) {
+        ServerClient &client = g_server.clients[i - 1];
+        if ((fds[i].revents & POLLOUT) && !server_flush(client)) {
+            server_drop(client);
+            continue;
+        }
+        if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        char buf[4096];
+        ssize_t n = read(client.fd, buf, sizeof buf);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+        if (n <= 0) {
+            server_drop(client);
+            continue;
+        }
+        client.input.append(buf, (size_t)n);
+        size_t nl;
+        while ((nl = client.input.find('\n')) != std::string::npos) {
+            std::string line = client.input.substr(0, nl);
+            client.input.erase(0, nl + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            client.output += server_command(line) + "\n";
+        }
+        if (!server_flush(client) || client.output.size() > SERVER_OUTPUT_LIMIT) {
+            server_drop(client);
+        }
     }
+    g_server.clients.erase(std::remove_if(g_server.clients.begin(), g_server.clients.end(),
+                                          [](const ServerClient &c) { return c.fd < 0; }),
+                           g_server.clients.end());
 
-    // Main simulation window
-    sf::RenderWindow mainWindow(sf::VideoMode({(unsigned)WIDTH, (unsigned)HEIGHT}),
-                                "SFML3 Disks + Chart");
-    mainWindow.setFramerateLimit(FPS);
+    if (fds[0].revents & POLLIN) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd >= 0 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0) {
+            g_server.clients.push_back({fd, std::string(), std::string()});
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+#endif
 
-    // Second stats window
-    sf::RenderWindow statsWindow(sf::VideoMode({300, 300}), "Coin Stats");
-    statsWindow.setFramerateLimit(FPS);
+int run_server(const std::string &path) {
+#if defined(__linux__) || defined(__APPLE__)
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << path << "\n";
+        return 1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (listener < 0 || bind(listener, (sockaddr *)&addr, sizeof addr) != 0 ||
+        listen(listener, 16) != 0) {
+        std::cerr << "Failed to listen on " << path << "\n";
+        if (listener >= 0) close(listener);
+        return 1;
+    }
+    struct stat st;
+    if (!g_serveDir.empty() && (stat(g_serveDir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))) {
+        std::cerr << "Not a directory: " << g_serveDir << "\n";
+        close(listener);
+        unlink(path.c_str());
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);        // a client that hangs up is just dropped
+    std::cout << "Serving on " << path << " with " << pool_size() << " threads\n";
 
-    // Create disks
-    std::vector<Disk> disks(DISK_COUNT);
-    std::vector<int> distribution = {8, 0, 0, 0, 0, 0};
-    for (int i = 0; i < DISK_COUNT; i++) {
-        float x  = (float)(DISK_RADIUS + rand() % (int(CHART_TOP) - 2*DISK_RADIUS));
-        float y  = (float)(DISK_RADIUS + rand() % (int(CHART_TOP) - 2*DISK_RADIUS));
-        float vx = velDist(rng);
-        float vy = velDist(rng);
-        // no initial speedFactor here, we apply g_speedFactor only in update_position
-        disks[i] = Disk{x, y, vx, vy, DISK_RADIUS, distribution[i]};
+    while (!g_server.stopping) {
+        server_poll(listener);
+        server_slice();
     }
+    for (auto &c : g_server.clients) {
+        server_flush(c);             // best effort: the shutdown reply
+        close(c.fd);
+    }
+    g_server.clients.clear();
+    close(listener);
+    unlink(path.c_str());
+    return 0;
+#else
+    std::cerr << "--serve needs UNIX sockets\n";
+    (void)path;
+    return 1;
+#endif
+}
+
+// The frame loop, for either disk store; returns once both windows close
+template <class Store>
+void run_simulation(Store &disks, std::mt19937 &rng, sf::RenderWindow &mainWindow,
+                    sf::RenderWindow &statsWindow, std::optional<sf::RenderWindow> &velocityWindow,
+                    AsyncOfstream &digestOut) {
+    inequality_init(disks);
+    occupancy_init(disks);
+    engine_init(disks);
+    Store &snapshot = frame_snapshot(disks);
 
     bool mainRunning = true;
     bool statsRunning = true;
 
     float time_since_plot = 0.f;
     sf::Clock clock;
+    TextSlots diskLabels;   // one persistent label per disk, up to MAX_DISK_LABELS
 
     // Main loop that handles both windows
     while (mainRunning || statsRunning) {
+        TraceScope frameTrace("frame");
         float dt = clock.restart().asSeconds();
+        if (g_fixedDt > 0.f) {
+            dt = g_fixedDt;
+        }
 
         // Poll events from mainWindow
         if (mainRunning && mainWindow.isOpen()) {
-    // Inside main loop, polling mainWindow events:
+            TraceScope trace("poll events");
 
             while (auto eOpt = mainWindow.pollEvent()) {
                 sf::Event e = *eOpt;
@@ -390,6 +5331,7 @@ int main() {
 
         // Poll events from statsWindow
         if (statsRunning && statsWindow.isOpen()) {
+            TraceScope trace("poll events");
             while (auto eOpt = statsWindow.pollEvent()) {
                 sf::Event e = *eOpt;
 
@@ -402,67 +5344,309 @@ int main() {
             }
         }
 
+        // Poll events from the velocity window
+        if (velocityWindow && velocityWindow->isOpen()) {
+            TraceScope trace("poll events");
+            while (auto eOpt = velocityWindow->pollEvent()) {
+                if (eOpt->is<sf::Event::Closed>()) {
+                    velocityWindow->close();
+                    break;
+                }
+            }
+        }
+
         // If main window is still running, update the simulation
         if (mainRunning && mainWindow.isOpen()) {
-            // Update positions
-            for (auto &d : disks) {
-                update_position(d, dt);
+            // Snapshot step t; a due chart sample reads live engine state here
+            time_since_plot += dt;
+            bool plotDue = time_since_plot >= 0.1f && collision_count > 0;
+            PlotSample sample;
+            {
+                TraceScope trace("snapshot");
+                take_snapshot(disks, snapshot);
+                if (plotDue) {
+                    sample = capture_live_stats(disks);
+                    if (g_lattice.agents > 0) {
+                        update_companion(g_latticeSeries, g_lattice.counts,
+                                         g_lattice.agents, g_lattice.exchanges);
+                    }
+                    if (g_graph.nodes > 0) {
+                        update_companion(g_graphSeries, g_graph.counts,
+                                         g_graph.nodes, g_graph.exchanges);
+                    }
+                }
             }
 
-            // Collisions
-            int collisions_this_frame = 0;
-            for (int i = 0; i < DISK_COUNT; i++) {
-                for (int j = i+1; j < DISK_COUNT; j++) {
-                    if (handle_disk_collision(disks[i], disks[j], rng)) {
-                        collisions_this_frame++;
-                    }
+            // Step t+1 runs alongside the chart update and disk geometry for t
+            long long collisions_this_frame = 0;
+            TaskGraph frame;
+            frame.add([&] {
+                // Update positions, then collisions
+                collisions_this_frame = physics_step(disks, dt, rng);
+                if (digestOut.is_open()) {
+                    TraceScope trace("digest");
+                    digestOut << step_count + 1 << " " << std::hex << std::setw(16) << std::setfill('0')
+                              << state_digest(disks) << std::dec << std::setfill(' ') << "\n";
                 }
+            });
+            if (g_lattice.agents > 0) {
+                frame.add([] { lattice_step(g_lattice); });
+            }
+            if (g_graph.nodes > 0) {
+                frame.add([] { graph_step(g_graph, g_graphBatch); });
+            }
+            if (plotDue) {
+                frame.add([&] {
+                    update_plot(snapshot, sample);
+                    enforce_memory_budget();
+                });
+            }
+            frame.add([&] { prepare_disk_vertices(snapshot, g_diskGeometry); });
+            if (g_shmDisks) {
+                frame.add([&] { shm_publish_frame(snapshot); });
             }
+            frame.run();
             collision_count += collisions_this_frame;
+            step_count++;
 
             // Chart update every 0.1s if collisions occurred
-            time_since_plot += dt;
-            if (time_since_plot >= 0.1f && collision_count > 0) {
-                update_plot(disks);
+            if (plotDue) {
                 time_since_plot = 0.f;
+
+                if (g_targetError > 0.0 && errors_below(g_targetError, g_diskCount)) {
+                    std::cout << "Target error reached after " << sample_count << " samples\n";
+                    mainWindow.close();
+                    mainRunning = false;
+                    statsWindow.close();
+                    statsRunning = false;
+                    break;
+                }
             }
 
-            // Render main window
+            // Render main window; draw calls stay on this thread
             mainWindow.clear(sf::Color::Black);
 
             // Draw disks
-            for (auto &d : disks) {
-                // Circle
-                sf::CircleShape circle(d.radius);
-                circle.setFillColor(sf::Color(0,128,255));
-                circle.setPosition(sf::Vector2f(d.x - d.radius, d.y - d.radius));
-                mainWindow.draw(circle);
-
-                // Coin count
-                sf::Text text(g_font, std::to_string(d.coin_count), 24);
-                text.setFillColor(sf::Color::White);
-                auto bounds = text.getLocalBounds();
-                text.setOrigin(sf::Vector2f(bounds.size.x*0.5f, bounds.size.y*0.5f));
-                text.setPosition(sf::Vector2f(d.x, d.y));
-                mainWindow.draw(text);
+            {
+                TraceScope trace("draw disks");
+                mainWindow.draw(g_diskGeometry.vertices.data(), g_diskGeometry.vertices.size(),
+                                g_diskGeometry.type);
+                // Past MAX_DISK_LABELS the digits are unreadable and the labels
+                // would cost more than the disks
+                size_t labels = snapshot.size() <= MAX_DISK_LABELS ? snapshot.size() : 0;
+                for (size_t i = 0; i < labels; i++) {
+                    const Disk &d = unpack(snapshot[i]);
+                    // Coin count
+                    sf::Text &text = slot_text(diskLabels, i, arena_printf("%d", d.coin_count), 24,
+                                               sf::Vector2f(0.5f, 0.5f));
+                    text.setFillColor(sf::Color::White);
+                    text.setPosition(sf::Vector2f(d.x, d.y));
+                    mainWindow.draw(text);
+                }
             }
 
             // Draw chart
             draw_line_graph(mainWindow);
 
-            mainWindow.display();
+            {
+                TraceScope trace("display");
+                mainWindow.display();
+            }
         }
 
         // If stats window is still running, draw the stats
         if (statsRunning && statsWindow.isOpen()) {
             draw_stats_window(statsWindow);
         }
+        if (velocityWindow && velocityWindow->isOpen()) {
+            draw_velocity_window(*velocityWindow);
+        }
+
+        arena_reset();
 
         // If both windows are closed, we exit the loop
         if (!mainRunning && !statsRunning) {
             break;
         }
     }
+}
+
+// Exports requested on the command line, after the run
+int write_exports() {
+    if (!g_exportPath.empty() && !export_histogram(g_exportPath, g_diskCount)) {
+        std::cerr << "Failed to write " << g_exportPath << "\n";
+        return 1;
+    }
+    if (!g_rdfExportPath.empty() && !export_rdf(g_rdfExportPath)) {
+        std::cerr << "Failed to write " << g_rdfExportPath << "\n";
+        return 1;
+    }
+    if (!g_tracePath.empty() && !write_trace(g_tracePath)) {
+        std::cerr << "Failed to write " << g_tracePath << "\n";
+        return 1;
+    }
 
     return 0;
 }
+
+int main(int argc, char **argv) {
+    if (!parse_args(argc, argv)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (!g_compareDigests.empty()) {
+        return compare_digests(g_compareDigests);
+    }
+    if (!g_shmRead.empty()) {
+        return shm_read(g_shmRead);
+    }
+
+    static_assert(MAX_COINS_PER_DISK + 1 <= 9, "reference fills the 9 chart bins");
+    exact_reference(g_diskCount, g_totalCoins, MAX_COINS_PER_DISK, g_exactReference);
+    if (g_printReference) {
+        if (g_totalCoins > MAX_COINS_PER_DISK) {
+            std::cerr << "Note: with more than " << MAX_COINS_PER_DISK << " coins the exchange clamp"
+                      << " destroys coins, so this is the capped law at " << g_totalCoins
+                      << " coins, not an exact stationary law\n";
+        }
+        std::cout << "coins,exact_mean_disks,exact_fraction\n";
+        for (int k = 0; k <= MAX_COINS_PER_DISK; k++) {
+            std::cout << k << "," << g_exactReference[k] << ","
+                      << g_exactReference[k] / g_diskCount << "\n";
+        }
+        return 0;
+    }
+
+    // Setup random
+    std::random_device rd;
+    if (!g_seedSet) {
+        g_seed = rd();
+    } else {
+        srand(g_seed);
+    }
+    std::mt19937 rng(g_seed);
+
+    if (!g_tracePath.empty()) {
+        trace_begin();
+    }
+    pool_start(g_threads, g_pinThreads);
+
+    if (g_checkEngines) {
+        int status = check_engines(g_seed);
+        if (!g_tracePath.empty() && !write_trace(g_tracePath)) {
+            std::cerr << "Failed to write " << g_tracePath << "\n";
+            return 1;
+        }
+        return status;
+    }
+
+    if (!g_servePath.empty()) {
+        return run_server(g_servePath);
+    }
+
+    if (!g_shmName.empty()) {
+        ShmDiskFormat format = !g_shmDisks ? SHM_NO_DISKS : g_compact ? SHM_COMPACT : SHM_DISKS;
+        if (!shm_init(g_shmName, format, g_diskCount)) {
+            std::cerr << "Failed to create shared memory " << shm_path(g_shmName) << ": "
+                      << std::strerror(errno) << "\n";
+            return 1;
+        }
+    }
+
+    if (!g_tileDir.empty()) {
+        int status = run_tiled(rng);
+        return status != 0 ? status : write_exports();
+    }
+
+    // Load our global font
+    if (!g_font.openFromFile("/System/Library/Fonts/SFNSMono.ttf")) {
+        std::cerr << "Failed to open font. Check path!\n";
+    }
+
+    // Main simulation window
+    sf::RenderWindow mainWindow(sf::VideoMode({(unsigned)WIDTH, (unsigned)HEIGHT}),
+                                "SFML3 Disks + Chart");
+    mainWindow.setFramerateLimit(FPS);
+
+    // Second stats window
+    sf::RenderWindow statsWindow(sf::VideoMode({360, 370 + 17 * (MEM_TAGS + 1)}), "Coin Stats");
+    statsWindow.setFramerateLimit(FPS);
+
+    // Optional velocity window, closed independently of the others
+    std::optional<sf::RenderWindow> velocityWindow;
+    if (g_velocityChart) {
+        velocityWindow.emplace(sf::VideoMode({400, 300}), "Velocity Stats");
+        velocityWindow->setFramerateLimit(FPS);
+    }
+
+    // Create disks: coins dealt from disk 0 up, unless --init gives a
+    // histogram to start near equilibrium
+    std::vector<int> distribution;
+    if (!g_initPath.empty()) {
+        std::vector<double> weights;
+        if (!load_coin_histogram(g_initPath, weights)) {
+            std::cerr << "Failed to read histogram " << g_initPath << "\n";
+            return 1;
+        }
+        distribution = sample_coin_distribution(weights, g_diskCount, g_totalCoins, rng);
+    } else {
+        distribution = deal_coins(g_diskCount, g_totalCoins);
+    }
+    DiskStore disks;
+    CompactStore compactDisks;
+    if (g_compact) {
+        compactDisks = place_disks<CompactStore>(distribution, rng);
+    } else {
+        disks = place_disks(distribution, rng);
+    }
+    if (g_latticeAgents > 0) {
+        // Same mean coins per agent as the disks
+        long long coins = std::min(g_latticeAgents * MAX_COINS_PER_DISK,
+                                   (long long)std::llround((double)g_latticeAgents * g_totalCoins / g_diskCount));
+        lattice_init(g_lattice, g_latticeAgents, g_latticeDensity, coins);
+    }
+    if (!g_graphPath.empty()) {
+        if (!graph_load(g_graph, g_graphPath, rng)) {
+            std::cerr << "Failed to load edge list " << g_graphPath << "\n";
+            return 1;
+        }
+        long long nodes = g_graph.nodes;
+        graph_deal_coins(g_graph, std::min(nodes * MAX_COINS_PER_DISK,
+                                           (long long)std::llround((double)nodes * g_totalCoins / g_diskCount)));
+    }
+
+    AsyncOfstream digestOut;
+    if (!g_digestPath.empty()) {
+        digestOut.open(g_digestPath);
+        if (!digestOut) {
+            std::cerr << "Failed to open " << g_digestPath << "\n";
+            return 1;
+        }
+        digestOut << "# disk_sim digest disks=" << g_diskCount << " seed=" << g_seed
+                  << " dt=" << g_fixedDt << "\n";
+        if (g_fixedDt <= 0.f) {
+            std::cerr << "Note: without --fixed-dt, digests follow the wall clock\n";
+        }
+    }
+
+    if (g_tune) {
+        if (g_compact) {
+            tune_startup(compactDisks, rng);
+        } else {
+            tune_startup(disks, rng);
+        }
+    }
+
+    if (g_compact) {
+        run_simulation(compactDisks, rng, mainWindow, statsWindow, velocityWindow, digestOut);
+    } else {
+        run_simulation(disks, rng, mainWindow, statsWindow, velocityWindow, digestOut);
+    }
+
+    if (digestOut.is_open() && !digestOut.close()) {
+        std::cerr << "Failed to write " << g_digestPath << "\n";
+        return 1;
+    }
+    return write_exports();
+}